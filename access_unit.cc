@@ -0,0 +1,97 @@
+#include "access_unit.hpp"
+
+AccessUnitAssembler::AccessUnitAssembler(Codec codec)
+    : codec_(codec)
+    , has_vcl_(false)
+{
+    current_.size = 0;
+    current_.keyframe = false;
+}
+
+// a first_mb_in_slice of 0 is the ue(v) code "1", and a first_slice_segment_in_pic_flag of 1 is
+// a 1 bit, both the top bit of the first payload byte behind the header
+static bool first_payload_bit(const NalView& nal, size_t header_size)
+{
+    return nal.size > header_size && (nal.data[header_size] & 0x80);
+}
+
+// Table 7-1 and 7.4.1.2.3
+static NalClass classify_h264(const NalView& nal)
+{
+    int nal_unit_type = nal.data[0] & 0x1f;
+    NalClass c = {};
+    c.nal_unit_type = nal_unit_type;
+    c.aud = nal_unit_type == 9;
+    c.param_set = nal_unit_type == 7 || nal_unit_type == 8;
+    c.prefix = (nal_unit_type >= 6 && nal_unit_type <= 9)
+               || (nal_unit_type >= 14 && nal_unit_type <= 18);
+    c.vcl = nal_unit_type >= 1 && nal_unit_type <= 5;
+    // partitions B and C start with slice_id
+    c.first_slice = (nal_unit_type == 1 || nal_unit_type == 2 || nal_unit_type == 5)
+                    && first_payload_bit(nal, 1);
+    c.keyframe = nal_unit_type == 5;
+    return c;
+}
+
+// Table 7-1 and 7.4.2.4.4
+static NalClass classify_h265(const NalView& nal)
+{
+    int nal_unit_type = (nal.data[0] >> 1) & 0x3f;
+    NalClass c = {};
+    c.nal_unit_type = nal_unit_type;
+    c.aud = nal_unit_type == 35;
+    c.param_set = nal_unit_type >= 32 && nal_unit_type <= 34;
+    c.prefix = (nal_unit_type >= 32 && nal_unit_type <= 35) || nal_unit_type == 39
+               || (nal_unit_type >= 41 && nal_unit_type <= 44)
+               || (nal_unit_type >= 48 && nal_unit_type <= 55);
+    c.vcl = nal_unit_type < 32;
+    c.first_slice = c.vcl && first_payload_bit(nal, 2);
+    c.keyframe = nal_unit_type >= 16 && nal_unit_type <= 23;
+    return c;
+}
+
+NalClass classify_nal(Codec codec, const NalView& nal)
+{
+    return codec == CODEC_H264 ? classify_h264(nal) : classify_h265(nal);
+}
+
+void AccessUnitAssembler::emit(AccessUnit* au)
+{
+    au->nals.swap(current_.nals);
+    au->size = current_.size;
+    au->keyframe = current_.keyframe;
+    current_.nals.clear();
+    current_.size = 0;
+    current_.keyframe = false;
+    has_vcl_ = false;
+}
+
+bool AccessUnitAssembler::push(const NalView& nal, AccessUnit* au)
+{
+    if (nal.size == 0)
+    {
+        return false;
+    }
+    NalClass c = classify_nal(codec_, nal);
+    bool done = false;
+    if ((has_vcl_ && (c.prefix || c.first_slice)) || (c.aud && !current_.nals.empty()))
+    {
+        emit(au);
+        done = true;
+    }
+    has_vcl_ = has_vcl_ || c.vcl;
+    current_.keyframe = current_.keyframe || c.keyframe;
+    current_.nals.push_back(nal);
+    current_.size += nal.size;
+    return done;
+}
+
+bool AccessUnitAssembler::flush(AccessUnit* au)
+{
+    if (current_.nals.empty())
+    {
+        return false;
+    }
+    emit(au);
+    return true;
+}
@@ -0,0 +1,58 @@
+#ifndef __ACCESS_UNIT_HPP__
+#define __ACCESS_UNIT_HPP__
+
+#include <vector>
+#include "nal_reader.hpp"
+#include "noncopyable.hpp"
+
+// The NAL units of one coded picture, in stream order. The views are not copied.
+struct AccessUnit
+{
+    std::vector<NalView> nals;
+    size_t size;    // payload bytes of all NAL units
+    bool keyframe;  // an IDR picture, or for H.265 any IRAP picture
+};
+
+// What the NAL header and the first payload bit tell about a NAL unit, by Table 7-1 of H.264 and
+// H.265. nal must not be empty.
+struct NalClass
+{
+    int nal_unit_type;
+    bool aud;
+    bool param_set;    // SPS or PPS, for H.265 also VPS
+    bool prefix;       // parameter sets, prefix SEI and the like go in front of the next picture
+    bool vcl;
+    bool first_slice;  // first slice of a new picture
+    bool keyframe;     // a slice of an IDR picture, or for H.265 of any IRAP picture
+};
+
+NalClass classify_nal(Codec codec, const NalView& nal);
+
+// Groups NAL units into access units by the rules of H.264 7.4.1.2.3 and H.265 7.4.2.4.4: an
+// AUD, a parameter set or a prefix SEI following a VCL NAL unit starts a new access unit, and so
+// does the first slice of a new picture (first_mb_in_slice 0 / first_slice_segment_in_pic_flag).
+// Only the NAL header and the first payload bit are looked at. The views handed to push must stay
+// valid until their access unit is returned, which a mapped NalReader guarantees.
+class AccessUnitAssembler
+{
+public:
+    explicit AccessUnitAssembler(Codec codec);
+
+    // Returns true if nal completed the previous access unit, which is then swapped into *au.
+    bool push(const NalView& nal, AccessUnit* au);
+
+    // Returns the last access unit at the end of the stream.
+    bool flush(AccessUnit* au);
+
+    NONCOPYABLE(AccessUnitAssembler);
+
+private:
+    void emit(AccessUnit* au);
+
+private:
+    Codec codec_;
+    AccessUnit current_;
+    bool has_vcl_;
+};
+
+#endif  // __ACCESS_UNIT_HPP__
@@ -0,0 +1,175 @@
+#include "batch.hpp"
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include "access_unit.hpp"
+#include "h264.hpp"
+#include "h265_sps.hpp"
+#include "scoped_exit.hpp"
+#include "work_stealing_pool.hpp"
+
+static bool ends_with(const std::string& s, const char* suffix)
+{
+    size_t n = strlen(suffix);
+    return s.size() >= n && strcasecmp(s.c_str() + s.size() - n, suffix) == 0;
+}
+
+Codec codec_from_filename(const std::string& filename, Codec fallback)
+{
+    if (ends_with(filename, ".h264") || ends_with(filename, ".264") || ends_with(filename, ".avc"))
+    {
+        return CODEC_H264;
+    }
+    if (ends_with(filename, ".h265") || ends_with(filename, ".265") || ends_with(filename, ".hevc"))
+    {
+        return CODEC_H265;
+    }
+    return fallback;
+}
+
+static void list_directory(const std::string& dir, std::vector<std::string>* filenames)
+{
+    DIR* d = opendir(dir.c_str());
+    if (!d)
+    {
+        return;
+    }
+    auto dir_close = make_scoped_exit([&d]() { closedir(d); });
+    std::vector<std::string> names;
+    while (struct dirent* e = readdir(d))
+    {
+        if (e->d_name[0] != '.')
+        {
+            names.push_back(e->d_name);
+        }
+    }
+    std::sort(names.begin(), names.end());
+    for (const auto& name : names)
+    {
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0)
+        {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode))
+        {
+            list_directory(path, filenames);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            filenames->push_back(path);
+        }
+    }
+}
+
+bool list_batch_inputs(const std::string& path, std::vector<std::string>* filenames)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0)
+    {
+        return false;
+    }
+    if (S_ISDIR(st.st_mode))
+    {
+        list_directory(path, filenames);
+        return true;
+    }
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp)
+    {
+        return false;
+    }
+    auto file_close = make_scoped_exit([&fp]() { fclose(fp); });
+    char line[4096];
+    while (fgets(line, sizeof(line), fp))
+    {
+        size_t n = strcspn(line, "\r\n");
+        line[n] = '\0';
+        if (n > 0 && line[0] != '#')
+        {
+            filenames->push_back(line);
+        }
+    }
+    return true;
+}
+
+void analyze_stream(const std::string& filename, Codec codec, StreamSummary* summary)
+{
+    auto begin = std::chrono::steady_clock::now();
+    *summary = StreamSummary();
+    summary->filename = filename;
+    summary->codec = codec;
+    NalReader reader;
+    summary->opened = reader.open(filename);
+    if (!summary->opened || !reader.find_first_start_code())
+    {
+        return;
+    }
+    h264_stream_t* h264 = codec == CODEC_H264 ? h264_new() : NULL;
+    h265_stream_t* h265 = codec == CODEC_H265 ? h265_new() : NULL;
+    auto stream_free = make_scoped_exit([&h264, &h265]() {
+        h264_free(h264);
+        h265_free(h265);
+    });
+    if (h265)
+    {
+        h265->sh->read_slice_type = 1;
+    }
+    AccessUnitAssembler assembler(codec);
+    AccessUnit au;
+    NalView nal;
+    while (reader.next(&nal))
+    {
+        summary->nals++;
+        summary->bytes += nal.size + nal.start_code_len;
+        if (assembler.push(nal, &au))
+        {
+            summary->access_units++;
+            summary->keyframes += au.keyframe;
+        }
+        int r = h264 ? h264_read_nal_unit(h264, nal.data, nal.size)
+                     : h265_read_nal_unit(h265, const_cast<uint8_t*>(nal.data), nal.size);
+        summary->broken += r < 0;
+    }
+    if (assembler.flush(&au))
+    {
+        summary->access_units++;
+        summary->keyframes += au.keyframe;
+    }
+    summary->seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+}
+
+uint64_t batch_analyze(const std::vector<std::string>& filenames, Codec fallback, int threads,
+                       std::vector<StreamSummary>* summaries)
+{
+    summaries->clear();
+    summaries->resize(filenames.size());
+    // queued shortest first, workers take the newest task of their deque, so the longest streams
+    // start first and do not end up last on a busy pool
+    std::vector<std::pair<off_t, size_t>> order;
+    for (size_t i = 0; i < filenames.size(); i++)
+    {
+        struct stat st;
+        order.push_back(std::make_pair(stat(filenames[i].c_str(), &st) == 0 ? st.st_size : 0, i));
+    }
+    std::sort(order.begin(), order.end(), [](const std::pair<off_t, size_t>& a,
+                                             const std::pair<off_t, size_t>& b) {
+        return a.first < b.first;
+    });
+    WorkStealingPool pool(threads);
+    for (const auto& o : order)
+    {
+        size_t i = o.second;
+        pool.submit([&filenames, fallback, summaries, i]() {
+            analyze_stream(
+                filenames[i], codec_from_filename(filenames[i], fallback), &(*summaries)[i]);
+        });
+    }
+    pool.wait();
+    return pool.steals();
+}
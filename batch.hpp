@@ -0,0 +1,38 @@
+#ifndef __BATCH_HPP__
+#define __BATCH_HPP__
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "nal_reader.hpp"
+
+// What batch_analyze found in one stream.
+struct StreamSummary
+{
+    std::string filename;
+    Codec codec;
+    bool opened;
+    uint64_t bytes;
+    uint64_t nals;
+    uint64_t access_units;
+    uint64_t keyframes;
+    uint64_t broken;  // NAL units the parser rejected
+    double seconds;
+};
+
+// .h264 .264 .avc and .h265 .265 .hevc pick the codec, anything else gets fallback.
+Codec codec_from_filename(const std::string& filename, Codec fallback);
+
+// path is a directory, searched recursively, or a text file with one filename per line.
+bool list_batch_inputs(const std::string& path, std::vector<std::string>* filenames);
+
+// Parses one stream with its own parser state.
+void analyze_stream(const std::string& filename, Codec codec, StreamSummary* summary);
+
+// Runs analyze_stream for every file on a work stealing pool of threads, the largest files are
+// started first. summaries are in the order of filenames. Returns how many streams were stolen by
+// another worker than the one they were queued on.
+uint64_t batch_analyze(const std::vector<std::string>& filenames, Codec fallback, int threads,
+                       std::vector<StreamSummary>* summaries);
+
+#endif  // __BATCH_HPP__
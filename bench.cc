@@ -0,0 +1,1151 @@
+// throughput benchmarks, run from the repository root: ./bench <name> [size in MiB]
+#include <assert.h>
+#include <boost/circular_buffer.hpp>
+#include <atomic>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "scoped_exit.hpp"
+#include "access_unit.hpp"
+#include "keyframe_scan.hpp"
+#include "length_prefixed.hpp"
+#include "nal_index.hpp"
+#include "nal_parser.hpp"
+#include "nal_reader.hpp"
+#include "parallel_scan.hpp"
+#include "start_code.hpp"
+#include "h264.hpp"
+#include "h265_sps.hpp"
+#include "rbsp.hpp"
+#include "read_bits.hpp"
+
+using CircularBytes = boost::circular_buffer<uint8_t>;
+using Bytes = std::vector<uint8_t>;
+
+static const char* kInput = "bench_input.bin";
+
+// Every heap allocation of the process, operator new included, goes through the glibc functions
+// below, which count them for bench_allocations.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* p, size_t size);
+extern "C" void* __libc_memalign(size_t alignment, size_t size);
+
+static std::atomic<uint64_t> g_allocations(0);
+
+extern "C" void* malloc(size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* p, size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(p, size);
+}
+
+// the aligned ones as well, aligned operator new ends up in aligned_alloc
+extern "C" void* memalign(size_t alignment, size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void* aligned_alloc(size_t alignment, size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void** p, size_t alignment, size_t size)
+{
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0)
+    {
+        return EINVAL;
+    }
+    void* q = __libc_memalign(alignment, size);
+    if (!q)
+    {
+        return ENOMEM;
+    }
+    *p = q;
+    return 0;
+}
+
+// checks that fail make bench exit with 1
+static int g_failures = 0;
+
+static void fail(const char* what)
+{
+    printf("FAILED: %s\n", what);
+    g_failures++;
+}
+
+static Bytes read_file(const char* filename)
+{
+    Bytes bytes;
+    FILE* fp = fopen(filename, "rb");
+    if (!fp)
+    {
+        return bytes;
+    }
+    auto file_close = make_scoped_exit([&fp]() { fclose(fp); });
+    fseek(fp, 0, SEEK_END);
+    bytes.resize(ftell(fp));
+    fseek(fp, 0, SEEK_SET);
+    if (fread(bytes.data(), 1, bytes.size(), fp) != bytes.size())
+    {
+        bytes.clear();
+    }
+    return bytes;
+}
+
+// the sources repeated until the file reaches size_mb
+static bool make_input_file(const char* filename, const std::vector<const char*>& sources,
+                            size_t size_mb)
+{
+    size_t size = size_mb << 20;
+    FILE* fp = fopen(filename, "rb");
+    if (fp)
+    {
+        fseek(fp, 0, SEEK_END);
+        size_t exist = ftell(fp);
+        fclose(fp);
+        if (exist >= size)
+        {
+            return true;
+        }
+    }
+    Bytes chunk;
+    for (const char* source : sources)
+    {
+        Bytes bytes = read_file(source);
+        if (bytes.empty())
+        {
+            printf("%s is required\n", source);
+            return false;
+        }
+        chunk.insert(chunk.end(), bytes.begin(), bytes.end());
+    }
+    fp = fopen(filename, "wb");
+    if (!fp)
+    {
+        return false;
+    }
+    auto file_close = make_scoped_exit([&fp]() { fclose(fp); });
+    for (size_t written = 0; written < size; written += chunk.size())
+    {
+        fwrite(chunk.data(), 1, chunk.size(), fp);
+    }
+    return true;
+}
+
+// video.h264 and video.h265 repeated until the file reaches size_mb
+static bool make_input(size_t size_mb)
+{
+    return make_input_file(kInput, {"video.h264", "video.h265"}, size_mb);
+}
+
+class Timer
+{
+public:
+    Timer()
+        : begin_(std::chrono::steady_clock::now())
+    {
+    }
+    double seconds() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin_).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point begin_;
+};
+
+static void report(const char* name, size_t bytes, size_t nals, double seconds)
+{
+    printf("%-24s %10zu nal %8.2f s %10.1f MB/s\n", name, nals, seconds, bytes / 1e6 / seconds);
+}
+
+// the getc and circular buffer loop main.cc used before find_start_code
+static size_t legacy_getc_scan(FILE* fp)
+{
+    CircularBytes bytes(3);
+    Bytes buffer;
+    size_t nals = 0;
+    while (feof(fp) == false)
+    {
+        bytes.clear();
+        buffer.clear();
+        while (feof(fp) == false)
+        {
+            if (bytes.size() == 3 && bytes[0] == 0x0 && bytes[1] == 0x0 && bytes[2] == 0x01)
+            {
+                break;
+            }
+            uint8_t ch = getc(fp);
+            if (bytes.size() == 3 && bytes[0] == 0x0 && bytes[1] == 0x0 && bytes[2] == 0x0
+                && ch == 0x01)
+            {
+                break;
+            }
+            bytes.push_back(ch);
+            buffer.push_back(ch);
+        }
+        nals++;
+    }
+    return nals;
+}
+
+static size_t file_size(const char* filename)
+{
+    struct stat st;
+    return stat(filename, &st) == 0 ? st.st_size : 0;
+}
+
+static void bench_start_code()
+{
+    size_t size = file_size(kInput);
+    {
+        Timer t;
+        NalReader reader;
+        reader.open(kInput);
+        NalView nal;
+        size_t nals = 0;
+        reader.find_first_start_code();
+        while (reader.next(&nal))
+        {
+            nals++;
+        }
+        std::string name = std::string("NalReader/") + start_code_scanner_name();
+        report(name.data(), size, nals, t.seconds());
+    }
+    {
+        FILE* fp = fopen(kInput, "rb");
+        auto file_close = make_scoped_exit([&fp]() { fclose(fp); });
+        Timer t;
+        size_t nals = legacy_getc_scan(fp);
+        report("getc loop", size, nals, t.seconds());
+    }
+}
+
+// NalParser fed with pieces of random size up to twice the mean, like packets off a socket
+static void bench_nal_parser()
+{
+    NalReader reader;
+    if (!reader.open(kInput) || !reader.mapped() || !reader.find_first_start_code())
+    {
+        return;
+    }
+    // the sizes NalReader finds, NalParser must hand out the same NAL units in the same order
+    std::vector<uint32_t> expected;
+    NalView nal;
+    while (reader.next(&nal))
+    {
+        expected.push_back(nal.size);
+    }
+    const uint8_t* data = reader.map_data();
+    size_t size = reader.map_size();
+    static const size_t kMeans[] = {1400, 64 << 10};
+    for (size_t mean : kMeans)
+    {
+        for (int frames = 0; frames < 2; frames++)
+        {
+            NalParser parser(CODEC_H264);
+            size_t index = 0;
+            size_t mismatches = 0;
+            parser.set_nal_callback([&](const NalView& view) {
+                mismatches += index >= expected.size() || view.size != expected[index];
+                index++;
+            });
+            if (frames)
+            {
+                parser.set_access_unit_callback([](const AccessUnit&) {});
+            }
+            srand(1);
+            Timer t;
+            for (size_t pos = 0; pos < size;)
+            {
+                size_t n = std::min<size_t>(size - pos, rand() % (2 * mean) + 1);
+                parser.push(data + pos, n);
+                pos += n;
+            }
+            parser.flush();
+            double seconds = t.seconds();
+            char name[64];
+            snprintf(name, sizeof(name), "NalParser/%zu%s", mean, frames ? "/frames" : "");
+            report(name, size, parser.nals(), seconds);
+            if (index != expected.size() || mismatches)
+            {
+                printf("NalParser %zu nal, NalReader %zu, %zu sizes differ\n",
+                       index,
+                       expected.size(),
+                       mismatches);
+                fail("NalParser split the input differently");
+            }
+        }
+    }
+}
+
+// drops the pages of filename from the page cache, as if it was an archive nobody read lately
+static bool evict_page_cache(const char* filename)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    fdatasync(fd);
+    bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+}
+
+// NalReader over the page cache cold bench input, in each read mode
+static void bench_read_ahead()
+{
+    static const ReadMode kModes[] = {READ_MAP, READ_PREAD, READ_AHEAD};
+    size_t size = file_size(kInput);
+    for (ReadMode mode : kModes)
+    {
+        if (!evict_page_cache(kInput))
+        {
+            printf("%s can not be evicted from the page cache\n", kInput);
+            return;
+        }
+        Timer t;
+        NalReader reader;
+        if (!reader.open(kInput, mode) || !reader.find_first_start_code())
+        {
+            return;
+        }
+        NalView nal;
+        size_t nals = 0;
+        while (reader.next(&nal))
+        {
+            nals++;
+        }
+        const char* name = "mmap";
+        if (mode != READ_MAP)
+        {
+            name = reader.uring() ? "io_uring" : "pread";
+        }
+        report(name, size, nals, t.seconds());
+    }
+}
+
+// Annex B to length prefixed over the mapped bench input: writev from the mapping against copying
+// every NAL unit behind its length into a buffer that is written in 1 MiB pieces
+static void bench_length_prefixed()
+{
+    static const char* kOutput = "bench_output.bin";
+    size_t size = file_size(kInput);
+    for (int copy = 0; copy < 2; copy++)
+    {
+        int fd = open(kOutput, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return;
+        }
+        auto file_remove = make_scoped_exit([&fd]() {
+            close(fd);
+            unlink(kOutput);
+        });
+        NalReader reader;
+        if (!reader.open(kInput) || !reader.find_first_start_code())
+        {
+            return;
+        }
+        Timer t;
+        NalView nal;
+        size_t nals = 0;
+        if (copy)
+        {
+            Bytes buffer;
+            bool ok = true;
+            while (ok && reader.next(&nal))
+            {
+                // empty NAL units are skipped like LengthPrefixedWriter does
+                if (nal.size == 0)
+                {
+                    continue;
+                }
+                uint8_t length[4] = {(uint8_t)(nal.size >> 24),
+                                     (uint8_t)(nal.size >> 16),
+                                     (uint8_t)(nal.size >> 8),
+                                     (uint8_t)nal.size};
+                buffer.insert(buffer.end(), length, length + 4);
+                buffer.insert(buffer.end(), nal.data, nal.data + nal.size);
+                if (buffer.size() >= (1 << 20))
+                {
+                    ok = write(fd, buffer.data(), buffer.size()) == (ssize_t)buffer.size();
+                    buffer.clear();
+                }
+                nals++;
+            }
+            if (!ok || write(fd, buffer.data(), buffer.size()) != (ssize_t)buffer.size())
+            {
+                fail("copy + write could not write the output");
+                return;
+            }
+        }
+        else
+        {
+            LengthPrefixedWriter writer(CODEC_H264, fd);
+            bool ok = true;
+            while (ok && reader.next(&nal))
+            {
+                ok = writer.write(nal);
+                nals += nal.size > 0;
+            }
+            if (!ok || !writer.flush())
+            {
+                fail("writev could not write the output");
+                return;
+            }
+        }
+        report(copy ? "copy + write" : "writev", size, nals, t.seconds());
+    }
+}
+
+// NalReader over the bench input and over the same NAL units with 4 byte lengths, mapped and
+// read into the buffer: the lengths skip the payload bytes the start code scan has to look at
+static void bench_length_prefixed_input()
+{
+    static const char* kLengthPrefixed = "bench_input_length_prefixed.bin";
+    {
+        NalReader reader;
+        int fd = open(kLengthPrefixed, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            return;
+        }
+        auto file_close = make_scoped_exit([&fd]() { close(fd); });
+        if (!reader.open(kInput) || !reader.find_first_start_code())
+        {
+            return;
+        }
+        LengthPrefixedWriter writer(CODEC_H264, fd);
+        NalView nal;
+        while (reader.next(&nal))
+        {
+            writer.write(nal);
+        }
+        writer.flush();
+    }
+    auto file_remove = make_scoped_exit([]() { unlink(kLengthPrefixed); });
+    for (ReadMode mode : {READ_MAP, READ_PREAD})
+    {
+        for (int length_size : {0, 4})
+        {
+            const char* filename = length_size ? kLengthPrefixed : kInput;
+            NalReader reader;
+            reader.set_length_size(length_size);
+            if (!reader.open(filename, mode) || !reader.find_first_start_code())
+            {
+                return;
+            }
+            Timer t;
+            NalView nal;
+            size_t nals = 0;
+            while (reader.next(&nal))
+            {
+                nals++;
+            }
+            std::string name = std::string(mode == READ_MAP ? "mapped" : "buffered")
+                               + (length_size ? " length prefixed" : " annex b");
+            report(name.data(), file_size(filename), nals, t.seconds());
+        }
+    }
+}
+
+// building the sidecar of the bench input against opening it again and seeking to a byte offset,
+// which is what every reopen of an indexed recording costs
+static void bench_nal_index()
+{
+    auto sidecar_remove = make_scoped_exit([]() {
+        unlink(NalIndex::sidecar_filename(kInput).c_str());
+    });
+    size_t size = file_size(kInput);
+    {
+        Timer t;
+        NalIndex index;
+        if (!index.open_or_build(kInput, CODEC_H264))
+        {
+            return;
+        }
+        report("build", size, index.header().nal_count, t.seconds());
+    }
+    const int kOpens = 1000;
+    Timer t;
+    uint64_t found = 0;
+    for (int i = 0; i < kOpens; i++)
+    {
+        NalIndex index;
+        if (index.open(kInput, CODEC_H264))
+        {
+            found += index.keyframe_at_offset(size / kOpens * i) != NULL;
+        }
+    }
+    double seconds = t.seconds();
+    printf("open + seek %d times %.3f ms each, %lu keyframes found\n",
+           kOpens,
+           seconds * 1000 / kOpens,
+           (unsigned long)found);
+}
+
+// the bit at a time reader ReadBit, H264Parse and bs_t used before peek_bits_64
+class LegacyReadBit
+{
+public:
+    LegacyReadBit(const uint8_t* start, uint64_t len)
+        : start_(start)
+        , length_(len)
+        , current_bit_(0)
+    {
+    }
+    unsigned int read_bit()
+    {
+        assert(current_bit_ <= length_ * 8);
+        int index = current_bit_ / 8;
+        int offset = current_bit_ % 8 + 1;
+
+        current_bit_++;
+        return (start_[index] >> (8 - offset)) & 0x01;
+    }
+    unsigned int read_n_bits(int n)
+    {
+        int r = 0;
+        for (int i = 0; i < n; i++)
+        {
+            r |= (read_bit() << (n - i - 1));
+        }
+        return r;
+    }
+    unsigned int read_ue()
+    {
+        int i = 0;
+        while ((read_bit() == 0) && (i < 32))
+        {
+            i++;
+        }
+        return read_n_bits(i) + (1 << i) - 1;
+    }
+    int read_se()
+    {
+        int r = read_ue();
+        return (r & 0x01) ? (r + 1) / 2 : -(r / 2);
+    }
+
+private:
+    const uint8_t* start_;
+    uint64_t length_;
+    uint64_t current_bit_;
+};
+
+// same syntax element sequence for every reader: u(n) with n in 1..32, ue(v), se(v)
+static const size_t kSyntaxElements = 1 << 22;
+
+template <typename Reader>
+static uint64_t decode_elements(Reader* r, const Bytes& widths)
+{
+    uint64_t sum = 0;
+    for (size_t i = 0; i < kSyntaxElements; i++)
+    {
+        sum += r->read_n_bits(widths[i]);
+        sum += r->read_ue();
+        sum += r->read_se();
+    }
+    return sum;
+}
+
+struct BsReader
+{
+    bs_t b;
+    unsigned int read_n_bits(int n) { return bs_read_u(&b, n); }
+    unsigned int read_ue() { return bs_read_ue(&b); }
+    int read_se() { return bs_read_se(&b); }
+};
+
+static void bench_bits()
+{
+    Bytes stream(kSyntaxElements * 16);
+    Bytes widths(kSyntaxElements);
+    bs_t w;
+    bs_init(&w, stream.data(), stream.size());
+    srand(1);
+    for (size_t i = 0; i < kSyntaxElements; i++)
+    {
+        widths[i] = 1 + rand() % 32;
+        bs_write_u(&w, widths[i], rand());
+        bs_write_ue(&w, rand() % (1 << (rand() % 16)));
+        bs_write_se(&w, rand() % 512 - 256);
+    }
+    size_t bytes = bs_pos(&w) + 1;
+    size_t elements = kSyntaxElements * 3;
+    {
+        Timer t;
+        LegacyReadBit r(stream.data(), bytes);
+        uint64_t sum = decode_elements(&r, widths);
+        double s = t.seconds();
+        printf("%-24s %10.1f M elements/s (sum %lx)\n", "bit at a time", elements / 1e6 / s, sum);
+    }
+    {
+        Timer t;
+        ReadBit r(stream.data(), bytes);
+        uint64_t sum = decode_elements(&r, widths);
+        double s = t.seconds();
+        printf("%-24s %10.1f M elements/s (sum %lx)\n", "ReadBit", elements / 1e6 / s, sum);
+    }
+    {
+        Timer t;
+        BsReader r;
+        bs_init(&r.b, stream.data(), bytes);
+        uint64_t sum = decode_elements(&r, widths);
+        double s = t.seconds();
+        printf("%-24s %10.1f M elements/s (sum %lx)\n", "bs_t", elements / 1e6 / s, sum);
+    }
+}
+
+// first fields of a slice segment header
+static uint32_t read_slice_start(bs_t* b)
+{
+    uint32_t sum = bs_read_u1(b);
+    for (int i = 0; i < 8; i++)
+    {
+        sum += bs_read_ue(b);
+    }
+    return sum;
+}
+
+// slice header reads from slice NALs of growing size, full unescape against bs_init_ebsp
+static void bench_slice_header()
+{
+    srand(1);
+    for (size_t size = 1 << 10; size <= (4 << 20); size <<= 4)
+    {
+        Bytes ebsp(size);
+        for (auto& byte : ebsp)
+        {
+            byte = rand() % 4 == 0 ? 0 : rand();
+        }
+        Bytes rbsp(size);
+        size_t loops = (64 << 20) / size;
+        uint64_t sum = 0;
+        Timer full;
+        for (size_t i = 0; i < loops; i++)
+        {
+            bs_t b;
+            bs_init(&b, rbsp.data(), unescape_rbsp(ebsp.data(), size, rbsp.data(), size));
+            sum += read_slice_start(&b);
+        }
+        double full_ns = full.seconds() * 1e9 / loops;
+        Timer lazy;
+        for (size_t i = 0; i < loops; i++)
+        {
+            bs_t b;
+            bs_init_ebsp(&b, rbsp.data(), ebsp.data(), size);
+            sum -= read_slice_start(&b);
+        }
+        double lazy_ns = lazy.seconds() * 1e9 / loops;
+        printf("%8zu byte slice  unescape all %10.0f ns  bs_init_ebsp %6.0f ns%s\n",
+               size,
+               full_ns,
+               lazy_ns,
+               sum ? " MISMATCH" : "");
+    }
+}
+
+// h265_read_nal_unit over the slices of video.h265, slice_type only against the full header
+static void bench_h265_slice_type()
+{
+    NalReader reader;
+    if (!reader.open("video.h265") || !reader.find_first_start_code())
+    {
+        printf("video.h265 is required\n");
+        return;
+    }
+    h265_stream_t* h = h265_new();
+    auto stream_free = make_scoped_exit([&h]() { h265_free(h); });
+    // parameter sets go into the tables once, only the slices are timed
+    std::vector<Bytes> slices;
+    NalView view;
+    while (reader.next(&view))
+    {
+        Bytes nal(view.data, view.data + view.size);
+        if (h265_read_nal_unit(h, nal.data(), nal.size()) > 0 && h->nal->parsed == h->sh)
+        {
+            slices.push_back(nal);
+        }
+    }
+    for (int read_slice_type = 1; read_slice_type >= 0; read_slice_type--)
+    {
+        h->sh->read_slice_type = read_slice_type;
+        size_t parsed = 0;
+        uint64_t sum = 0;
+        Timer timer;
+        for (int loop = 0; loop < 200000; loop++)
+        {
+            for (auto& nal : slices)
+            {
+                if (h265_read_nal_unit(h, nal.data(), nal.size()) > 0)
+                {
+                    sum += h->sh->slice_type + h->sh->slice_pic_order_cnt_lsb;
+                    parsed++;
+                }
+            }
+        }
+        double seconds = timer.seconds();
+        printf("%-12s %8.2f M slices/s (%lu)\n",
+               read_slice_type ? "slice_type" : "full header",
+               parsed / seconds / 1e6,
+               (unsigned long)sum);
+    }
+}
+
+// h264_read_nal_unit over the slices of video.h264, the header is read up to redundant_pic_cnt
+static void bench_h264_slice_type()
+{
+    NalReader reader;
+    if (!reader.open("video.h264") || !reader.find_first_start_code())
+    {
+        printf("video.h264 is required\n");
+        return;
+    }
+    h264_stream_t* h = h264_new();
+    auto stream_free = make_scoped_exit([&h]() { h264_free(h); });
+    std::vector<Bytes> slices;
+    NalView view;
+    while (reader.next(&view))
+    {
+        Bytes nal(view.data, view.data + view.size);
+        if (h264_read_nal_unit(h, nal.data(), nal.size()) > 0
+            && (h->nal.nal_unit_type == H264_NAL_UNIT_TYPE_CODED_SLICE_NON_IDR
+                || h->nal.nal_unit_type == H264_NAL_UNIT_TYPE_CODED_SLICE_IDR))
+        {
+            slices.push_back(nal);
+        }
+    }
+    size_t parsed = 0;
+    uint64_t sum = 0;
+    Timer timer;
+    for (int loop = 0; loop < 200000; loop++)
+    {
+        for (auto& nal : slices)
+        {
+            if (h264_read_nal_unit(h, nal.data(), nal.size()) > 0)
+            {
+                sum += h->sh.slice_type + h->sh.frame_num;
+                parsed++;
+            }
+        }
+    }
+    double seconds = timer.seconds();
+    printf("slice_type   %8.2f M slices/s (%lu)\n", parsed / seconds / 1e6, (unsigned long)sum);
+}
+
+// the parameter sets of video.h265 sent again and again, parsed each time against cache hits
+static void bench_param_set_cache()
+{
+    NalReader reader;
+    if (!reader.open("video.h265") || !reader.find_first_start_code())
+    {
+        printf("video.h265 is required\n");
+        return;
+    }
+    std::vector<Bytes> param_sets;
+    NalView view;
+    while (reader.next(&view))
+    {
+        int nal_unit_type = (view.data[0] >> 1) & 0x3f;
+        if (nal_unit_type >= NAL_UNIT_VPS && nal_unit_type <= NAL_UNIT_PPS)
+        {
+            param_sets.push_back(Bytes(view.data, view.data + view.size));
+        }
+    }
+    for (int cached = 0; cached < 2; cached++)
+    {
+        h265_stream_t* h = h265_new();
+        auto stream_free = make_scoped_exit([&h]() { h265_free(h); });
+        size_t loops = 1000000;
+        Timer timer;
+        for (size_t i = 0; i < loops; i++)
+        {
+            for (auto& nal : param_sets)
+            {
+                h265_read_nal_unit(h, nal.data(), nal.size());
+            }
+            if (!cached)
+            {
+                for (auto& key : h->vps_keys)
+                {
+                    param_set_key_clear(&key);
+                }
+                for (auto& key : h->sps_keys)
+                {
+                    param_set_key_clear(&key);
+                }
+                for (auto& key : h->pps_keys)
+                {
+                    param_set_key_clear(&key);
+                }
+            }
+        }
+        double ns = timer.seconds() * 1e9 / (loops * param_sets.size());
+        printf("%-8s %8.1f ns per parameter set  hits %lu misses %lu\n",
+               cached ? "cached" : "parsed",
+               ns,
+               (unsigned long)h->param_set_cache.hits,
+               (unsigned long)h->param_set_cache.misses);
+    }
+}
+
+static size_t g_size_mb = 1024;
+
+// parallel_scan over video.h264 and video.h265 each repeated to the requested size
+static void bench_parallel_scan()
+{
+    struct Input
+    {
+        const char* filename;
+        const char* source;
+        Codec codec;
+    };
+    static const Input inputs[] = {
+        {"bench_input_h264.bin", "video.h264", CODEC_H264},
+        {"bench_input_h265.bin", "video.h265", CODEC_H265},
+    };
+    int max_threads = std::max(4, (int)std::thread::hardware_concurrency());
+    printf("hardware threads %u\n", std::thread::hardware_concurrency());
+    for (const auto& input : inputs)
+    {
+        NalReader reader;
+        if (!make_input_file(input.filename, {input.source}, g_size_mb)
+            || !reader.open(input.filename) || !reader.mapped())
+        {
+            return;
+        }
+        // the first pass faults the mapping in
+        std::vector<NalRecord> records;
+        parallel_scan(reader.map_data(), reader.map_size(), input.codec, max_threads, &records);
+        double single = 0;
+        size_t nals = 0;
+        for (int threads = 1; threads <= max_threads; threads *= 2)
+        {
+            Timer timer;
+            parallel_scan(reader.map_data(), reader.map_size(), input.codec, threads, &records);
+            double seconds = timer.seconds();
+            single = threads == 1 ? seconds : single;
+            if (threads == 1)
+            {
+                nals = records.size();
+            }
+            else if (records.size() != nals)
+            {
+                printf("%s: %zu nal with %d threads, %zu with one\n",
+                       input.filename, records.size(), threads, nals);
+            }
+            printf("%s %2d threads %10zu nal %8.2f s %10.1f MB/s %6.2fx\n",
+                   input.source,
+                   threads,
+                   records.size(),
+                   seconds,
+                   reader.map_size() / 1e6 / seconds,
+                   single / seconds);
+        }
+    }
+}
+
+// keyframe_scan over one codec repeated up to size_mb, against the parse loop of the sequential
+// path of main.cc without its output (every NAL unit through h264/h265_read_nal_unit with the
+// slice_type fast path, grouped into access units) and, when it was built, ./a.out itself with
+// its output to /dev/null. The scan must find the keyframes the parse loop finds.
+static void bench_keyframe_scan()
+{
+    struct Input
+    {
+        const char* filename;
+        const char* source;
+        Codec codec;
+    };
+    static const Input inputs[] = {
+        {"bench_input_h264.bin", "video.h264", CODEC_H264},
+        {"bench_input_h265.bin", "video.h265", CODEC_H265},
+    };
+    for (const auto& input : inputs)
+    {
+        if (!make_input_file(input.filename, {input.source}, g_size_mb))
+        {
+            return;
+        }
+        size_t size = file_size(input.filename);
+        size_t full_keyframes = 0;
+        {
+            NalReader reader;
+            if (!reader.open(input.filename) || !reader.find_first_start_code())
+            {
+                return;
+            }
+            h264_stream_t* h264 = h264_new();
+            h265_stream_t* h265 = h265_new();
+            auto stream_free = make_scoped_exit([&h264, &h265]() {
+                h264_free(h264);
+                h265_free(h265);
+            });
+            h265->sh->read_slice_type = 1;
+            AccessUnitAssembler assembler(input.codec);
+            AccessUnit au;
+            Timer t;
+            NalView nal;
+            size_t nals = 0;
+            while (reader.next(&nal))
+            {
+                if (assembler.push(nal, &au))
+                {
+                    full_keyframes += au.keyframe;
+                }
+                if (input.codec == CODEC_H264)
+                {
+                    h264_read_nal_unit(h264, nal.data, nal.size);
+                }
+                else
+                {
+                    h265_read_nal_unit(h265, const_cast<uint8_t*>(nal.data), nal.size);
+                }
+                nals++;
+            }
+            if (assembler.flush(&au))
+            {
+                full_keyframes += au.keyframe;
+            }
+            std::string name = std::string(input.source) + " full parse";
+            report(name.data(), size, nals, t.seconds());
+        }
+        if (access("a.out", X_OK) == 0)
+        {
+            std::string command = std::string("./a.out ")
+                                  + (input.codec == CODEC_H264 ? "-264 " : "") + input.filename
+                                  + " > /dev/null";
+            Timer t;
+            if (system(command.c_str()) != 0)
+            {
+                fail("a.out could not parse the input");
+            }
+            double seconds = t.seconds();
+            printf("%-24s %10s     %8.2f s %10.1f MB/s\n",
+                   (std::string(input.source) + " a.out").data(),
+                   "",
+                   seconds,
+                   size / 1e6 / seconds);
+        }
+        {
+            NalReader reader;
+            if (!reader.open(input.filename) || !reader.find_first_start_code())
+            {
+                return;
+            }
+            Timer t;
+            std::vector<KeyframeRecord> records;
+            keyframe_scan(&reader, input.codec, &records);
+            double seconds = t.seconds();
+            size_t keyframes = 0;
+            for (const auto& r : records)
+            {
+                keyframes += r.keyframe;
+            }
+            std::string name = std::string(input.source) + " keyframes";
+            report(name.data(), size, records.size(), seconds);
+            if (keyframes != full_keyframes)
+            {
+                printf("%s: %zu keyframes, %zu by the full parse\n",
+                       input.source,
+                       keyframes,
+                       full_keyframes);
+                fail("keyframe_scan and the full parse disagree");
+            }
+        }
+    }
+}
+
+static bool read_nals(const char* filename, std::vector<Bytes>* nals)
+{
+    NalReader reader;
+    if (!reader.open(filename) || !reader.find_first_start_code())
+    {
+        printf("%s is required\n", filename);
+        return false;
+    }
+    NalView view;
+    while (reader.next(&view))
+    {
+        nals->push_back(Bytes(view.data, view.data + view.size));
+    }
+    return true;
+}
+
+// parses nals again and again after a warm-up pass, with the parameter set cache cleared before
+// every pass unless cached
+template <typename Read, typename Clear>
+static void count_allocations(const char* name, const std::vector<Bytes>& nals, bool cached,
+                              Read read, Clear clear_keys)
+{
+    for (const auto& nal : nals)
+    {
+        read(nal);
+    }
+    size_t loops = 1000;
+    uint64_t before = g_allocations.load();
+    for (size_t i = 0; i < loops; i++)
+    {
+        if (!cached)
+        {
+            clear_keys();
+        }
+        for (const auto& nal : nals)
+        {
+            read(nal);
+        }
+    }
+    uint64_t allocations = g_allocations.load() - before;
+    printf("%-6s %-8s %10zu nal %10lu allocations %8.4f per nal\n",
+           name,
+           cached ? "cached" : "parsed",
+           loops * nals.size(),
+           (unsigned long)allocations,
+           (double)allocations / (loops * nals.size()));
+    if (allocations != 0)
+    {
+        fail("steady state parsing allocated");
+    }
+}
+
+// Heap allocations of full header parsing once the parser state reached its high water mark,
+// which must be zero. The dump of process_nal_payload in main.cc is left out: it only copies a
+// parameter set the cache has not seen, which a steady state stream does not send.
+static void bench_allocations()
+{
+    std::vector<Bytes> nals;
+    if (!read_nals("video.h264", &nals))
+    {
+        return;
+    }
+    for (int cached = 1; cached >= 0; cached--)
+    {
+        h264_stream_t* h = h264_new();
+        auto stream_free = make_scoped_exit([&h]() { h264_free(h); });
+        count_allocations(
+            "h264",
+            nals,
+            cached,
+            [h](const Bytes& nal) { h264_read_nal_unit(h, nal.data(), nal.size()); },
+            [h]() {
+                for (auto& key : h->sps_keys)
+                {
+                    param_set_key_clear(&key);
+                }
+                for (auto& key : h->pps_keys)
+                {
+                    param_set_key_clear(&key);
+                }
+            });
+    }
+    nals.clear();
+    if (!read_nals("video.h265", &nals))
+    {
+        return;
+    }
+    for (int cached = 1; cached >= 0; cached--)
+    {
+        h265_stream_t* h = h265_new();
+        auto stream_free = make_scoped_exit([&h]() { h265_free(h); });
+        count_allocations(
+            "h265",
+            nals,
+            cached,
+            [h](const Bytes& nal) {
+                h265_read_nal_unit(h, const_cast<uint8_t*>(nal.data()), nal.size());
+            },
+            [h]() {
+                for (auto& key : h->vps_keys)
+                {
+                    param_set_key_clear(&key);
+                }
+                for (auto& key : h->sps_keys)
+                {
+                    param_set_key_clear(&key);
+                }
+                for (auto& key : h->pps_keys)
+                {
+                    param_set_key_clear(&key);
+                }
+            });
+    }
+}
+
+struct Bench
+{
+    const char* name;
+    void (*run)();
+    bool needs_input;
+};
+
+static const Bench kBenches[] = {
+    {"start_code", bench_start_code, true},
+    {"nal_parser", bench_nal_parser, true},
+    {"read_ahead", bench_read_ahead, true},
+    {"length_prefixed", bench_length_prefixed, true},
+    {"length_prefixed_input", bench_length_prefixed_input, true},
+    {"nal_index", bench_nal_index, true},
+    {"bits", bench_bits, false},
+    {"slice_header", bench_slice_header, false},
+    {"h265_slice_type", bench_h265_slice_type, false},
+    {"param_set_cache", bench_param_set_cache, false},
+    {"h264_slice_type", bench_h264_slice_type, false},
+    {"parallel_scan", bench_parallel_scan, false},
+    {"keyframe_scan", bench_keyframe_scan, false},
+    {"allocations", bench_allocations, false},
+};
+
+int main(int argc, char** argv)
+{
+    if (argc < 2)
+    {
+        printf("%s name [size_mb]\n", argv[0]);
+        for (const auto& b : kBenches)
+        {
+            printf("    %s\n", b.name);
+        }
+        exit(0);
+    }
+    size_t size_mb = argc > 2 ? strtoul(argv[2], NULL, 10) : 1024;
+    g_size_mb = size_mb;
+    for (const auto& b : kBenches)
+    {
+        if (strcmp(argv[1], b.name) != 0 && strcmp(argv[1], "all") != 0)
+        {
+            continue;
+        }
+        if (b.needs_input && !make_input(size_mb))
+        {
+            return 1;
+        }
+        b.run();
+    }
+    return g_failures ? 1 : 0;
+}
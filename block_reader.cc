@@ -0,0 +1,290 @@
+#include "block_reader.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+
+// there is no liburing on the build hosts, the two system calls are all we need
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+BlockReader::BlockReader(size_t block_size, int depth)
+    : block_size_(block_size)
+    , depth_(std::max(depth, 1))
+    , fd_(-1)
+    , size_(0)
+    , blocks_(0)
+    , next_(0)
+    , submitted_(0)
+    , inflight_(0)
+    , handed_out_(false)
+    , failed_(false)
+    , ring_fd_(-1)
+    , sq_ring_(NULL)
+    , sq_ring_size_(0)
+    , cq_ring_(NULL)
+    , cq_ring_size_(0)
+    , sqes_(NULL)
+    , sqes_size_(0)
+    , sq_tail_(NULL)
+    , sq_mask_(NULL)
+    , sq_array_(NULL)
+    , cq_head_(NULL)
+    , cq_tail_(NULL)
+    , cq_mask_(NULL)
+    , cqes_(NULL)
+{
+}
+
+BlockReader::~BlockReader() { close(); }
+
+bool BlockReader::setup_uring()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = sys_io_uring_setup(depth_, &p);
+    if (fd < 0)
+    {
+        return false;
+    }
+    ring_fd_ = fd;
+    sq_ring_size_ = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    bool single_mmap = p.features & IORING_FEAT_SINGLE_MMAP;
+    if (single_mmap)
+    {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_SHARED | MAP_POPULATE;
+    void* sq = mmap(NULL, sq_ring_size_, prot, flags, fd, IORING_OFF_SQ_RING);
+    sq_ring_ = sq == MAP_FAILED ? NULL : sq;
+    void* cq = single_mmap ? sq : mmap(NULL, cq_ring_size_, prot, flags, fd, IORING_OFF_CQ_RING);
+    cq_ring_ = cq == MAP_FAILED ? NULL : cq;
+    sqes_size_ = p.sq_entries * sizeof(struct io_uring_sqe);
+    void* sqes = mmap(NULL, sqes_size_, prot, flags, fd, IORING_OFF_SQES);
+    sqes_ = sqes == MAP_FAILED ? NULL : sqes;
+    if (!sq_ring_ || !cq_ring_ || !sqes_)
+    {
+        close_ring();
+        return false;
+    }
+    char* sq_base = static_cast<char*>(sq_ring_);
+    sq_tail_ = reinterpret_cast<unsigned*>(sq_base + p.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned*>(sq_base + p.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned*>(sq_base + p.sq_off.array);
+    char* cq_base = static_cast<char*>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned*>(cq_base + p.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned*>(cq_base + p.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned*>(cq_base + p.cq_off.ring_mask);
+    cqes_ = cq_base + p.cq_off.cqes;
+    return true;
+}
+
+bool BlockReader::open(int fd, uint64_t size, bool use_uring)
+{
+    close();
+    fd_ = fd;
+    size_ = size;
+    blocks_ = (size + block_size_ - 1) / block_size_;
+    buffer_.resize(block_size_ * depth_);
+    results_.assign(depth_, 0);
+    completed_.assign(depth_, false);
+    if (use_uring && setup_uring())
+    {
+        while (submitted_ < blocks_ && submitted_ < (uint64_t)depth_)
+        {
+            submit(submitted_++);
+        }
+    }
+    else
+    {
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    return !failed_;
+}
+
+void BlockReader::close_ring()
+{
+    if (sqes_)
+    {
+        munmap(sqes_, sqes_size_);
+    }
+    if (cq_ring_ && cq_ring_ != sq_ring_)
+    {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    if (sq_ring_)
+    {
+        munmap(sq_ring_, sq_ring_size_);
+    }
+    if (ring_fd_ >= 0)
+    {
+        ::close(ring_fd_);
+    }
+    ring_fd_ = -1;
+    sq_ring_ = NULL;
+    cq_ring_ = NULL;
+    sqes_ = NULL;
+}
+
+void BlockReader::close()
+{
+    // the kernel must not write into buffer_ once it is gone
+    while (inflight_ > 0 && reap())
+    {
+    }
+    close_ring();
+    fd_ = -1;
+    size_ = 0;
+    blocks_ = 0;
+    next_ = 0;
+    submitted_ = 0;
+    inflight_ = 0;
+    handed_out_ = false;
+    failed_ = false;
+}
+
+size_t BlockReader::block_bytes(uint64_t block) const
+{
+    return std::min<uint64_t>(block_size_, size_ - block * block_size_);
+}
+
+uint8_t* BlockReader::slot(uint64_t block)
+{
+    return buffer_.data() + block % depth_ * block_size_;
+}
+
+void BlockReader::submit(uint64_t block)
+{
+    unsigned tail = *sq_tail_;
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe* sqe = static_cast<struct io_uring_sqe*>(sqes_) + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = fd_;
+    sqe->off = block * block_size_;
+    sqe->addr = reinterpret_cast<uint64_t>(slot(block));
+    sqe->len = block_bytes(block);
+    sqe->user_data = block;
+    sq_array_[index] = index;
+    __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+    completed_[block % depth_] = false;
+    while (true)
+    {
+        int r = sys_io_uring_enter(ring_fd_, 1, 0, 0);
+        if (r >= 0)
+        {
+            inflight_++;
+            return;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+        {
+            // the entry stays in the ring, nothing sensible can be read after it
+            failed_ = true;
+            return;
+        }
+    }
+}
+
+// takes one completion off the ring, waiting for it if there is none yet
+bool BlockReader::reap()
+{
+    while (true)
+    {
+        unsigned head = *cq_head_;
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        if (head != tail)
+        {
+            const struct io_uring_cqe* cqe =
+                static_cast<const struct io_uring_cqe*>(cqes_) + (head & *cq_mask_);
+            size_t index = cqe->user_data % depth_;
+            results_[index] = cqe->res;
+            completed_[index] = true;
+            __atomic_store_n(cq_head_, head + 1, __ATOMIC_RELEASE);
+            inflight_--;
+            return true;
+        }
+        int r = sys_io_uring_enter(ring_fd_, 0, 1, IORING_ENTER_GETEVENTS);
+        if (r < 0 && errno != EINTR)
+        {
+            return false;
+        }
+    }
+}
+
+// preads what the ring did not: all of it without io_uring, the rest of a short read, or the
+// whole block if the kernel knows no IORING_OP_READ
+bool BlockReader::read_rest(uint64_t block, size_t done)
+{
+    size_t want = block_bytes(block);
+    uint8_t* p = slot(block);
+    while (done < want)
+    {
+        ssize_t r = pread(fd_, p + done, want - done, block * block_size_ + done);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            return false;
+        }
+        done += r;
+    }
+    return true;
+}
+
+bool BlockReader::next(const uint8_t** data, size_t* size)
+{
+    if (failed_)
+    {
+        return false;
+    }
+    // the caller is done with the previous block, its slot takes the next read
+    if (handed_out_ && uring() && submitted_ < blocks_)
+    {
+        submit(submitted_++);
+    }
+    handed_out_ = false;
+    if (next_ >= blocks_ || failed_)
+    {
+        return false;
+    }
+    uint64_t block = next_;
+    size_t done = 0;
+    if (uring())
+    {
+        size_t index = block % depth_;
+        while (!completed_[index])
+        {
+            if (!reap())
+            {
+                failed_ = true;
+                return false;
+            }
+        }
+        done = results_[index] > 0 ? results_[index] : 0;
+    }
+    if (!read_rest(block, done))
+    {
+        failed_ = true;
+        return false;
+    }
+    *data = slot(block);
+    *size = block_bytes(block);
+    next_++;
+    handed_out_ = true;
+    return true;
+}
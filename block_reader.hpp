@@ -0,0 +1,70 @@
+#ifndef __BLOCK_READER_HPP__
+#define __BLOCK_READER_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "noncopyable.hpp"
+
+// Reads a regular file front to back in large blocks. With io_uring the reads of the next depth
+// blocks are in flight while the caller works on the current one, which keeps a cold NVMe drive
+// busy. Without io_uring (old kernels, seccomp) every block is a plain pread.
+class BlockReader
+{
+public:
+    explicit BlockReader(size_t block_size = 1 << 20, int depth = 8);
+    ~BlockReader();
+
+    // fd stays owned by the caller. use_uring false forces the pread fallback.
+    bool open(int fd, uint64_t size, bool use_uring = true);
+    void close();
+    bool uring() const { return ring_fd_ >= 0; }
+
+    // The blocks in file order, the last one may be short. The data stays valid until the next
+    // call. Returns false at the end of the file or on a read error.
+    bool next(const uint8_t** data, size_t* size);
+
+    NONCOPYABLE(BlockReader);
+
+private:
+    bool setup_uring();
+    void close_ring();
+    void submit(uint64_t block);
+    bool reap();
+    bool read_rest(uint64_t block, size_t done);
+    size_t block_bytes(uint64_t block) const;
+    uint8_t* slot(uint64_t block);
+
+private:
+    size_t block_size_;
+    int depth_;
+    int fd_;
+    uint64_t size_;
+    uint64_t blocks_;
+    uint64_t next_;                // the block next() hands out
+    uint64_t submitted_;           // blocks whose read was submitted
+    int inflight_;                 // submitted reads not completed yet
+    bool handed_out_;              // the slot of block next_ - 1 is still in use by the caller
+    bool failed_;
+    std::vector<uint8_t> buffer_;  // depth slots of block_size
+    std::vector<int> results_;     // per slot, bytes read or -errno once the read completed
+    std::vector<bool> completed_;
+
+    // io_uring state
+    int ring_fd_;
+    void* sq_ring_;
+    size_t sq_ring_size_;
+    void* cq_ring_;
+    size_t cq_ring_size_;
+    void* sqes_;
+    size_t sqes_size_;
+    unsigned* sq_tail_;
+    unsigned* sq_mask_;
+    unsigned* sq_array_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned* cq_mask_;
+    void* cqes_;
+};
+
+#endif  // __BLOCK_READER_HPP__
@@ -0,0 +1,167 @@
+#include "gop_cut.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "access_unit.hpp"
+#include "param_set_store.hpp"
+#include "scoped_exit.hpp"
+#include "write_all.hpp"
+
+// size bytes of in from offset to the position of out, in the kernel
+static bool copy_range(int in, int out, uint64_t offset, uint64_t size)
+{
+    loff_t off = offset;
+    bool use_sendfile = false;
+    while (size > 0)
+    {
+        size_t count = std::min<uint64_t>(size, 1 << 30);
+        ssize_t n = 0;
+        if (!use_sendfile)
+        {
+            n = copy_file_range(in, &off, out, NULL, count, 0);
+            // pipes, sockets, O_APPEND, other file systems on old kernels
+            if (n < 0 && errno != EINTR)
+            {
+                use_sendfile = true;
+                continue;
+            }
+        }
+        else
+        {
+            off_t sendfile_off = off;
+            n = sendfile(out, in, &sendfile_off, count);
+            if (n > 0)
+            {
+                off = sendfile_off;
+            }
+        }
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        size -= n;
+    }
+    return true;
+}
+
+static NalView view_of(const uint8_t* data, const NalIndexNal& nal)
+{
+    NalView v = {data + nal.offset, nal.size, nal.start_code_len};
+    return v;
+}
+
+bool cut_stream(const NalIndex& index, const std::string& filename, uint64_t begin, uint64_t end,
+                int fd, CutResult* result)
+{
+    const NalIndexHeader& h = index.header();
+    end = std::min(end, h.access_unit_count);
+    if (begin >= end)
+    {
+        return false;
+    }
+    const NalIndexAccessUnit* access_units = index.access_units();
+    const NalIndexAccessUnit* key = index.keyframe_at_offset(access_units[begin].offset);
+    if (!key)
+    {
+        return false;
+    }
+    const NalIndexAccessUnit& last = access_units[end - 1];
+    NalReader reader;
+    int in = ::open(filename.c_str(), O_RDONLY);
+    if (in < 0 || !reader.open(filename) || !reader.mapped())
+    {
+        if (in >= 0)
+        {
+            ::close(in);
+        }
+        return false;
+    }
+    auto file_close = make_scoped_exit([&in]() { ::close(in); });
+    const uint8_t* data = reader.map_data();
+    const NalIndexNal* nals = index.nals();
+    Codec codec = (Codec)h.codec;
+
+    // the parameter sets in front of the first slice of the keyframe, nothing behind it is read
+    uint32_t au_end = key->first_nal + key->nal_count;
+    uint32_t first_slice = key->first_nal;
+    while (first_slice < au_end && (nals[first_slice].size == 0
+                                    || !classify_nal(codec, view_of(data, nals[first_slice])).vcl))
+    {
+        first_slice++;
+    }
+    if (first_slice == au_end)
+    {
+        return false;
+    }
+    ParamSetStore param_sets(codec);
+    for (uint32_t i = 0; i < first_slice; i++)
+    {
+        if (nals[i].size > 0 && classify_nal(codec, view_of(data, nals[i])).param_set)
+        {
+            param_sets.push(view_of(data, nals[i]));
+        }
+    }
+    const std::vector<uint8_t>* sets[3];
+    int set_count = param_sets.active_sets(view_of(data, nals[first_slice]), sets);
+
+    // each one the access unit does not carry byte for byte, behind a start code or length
+    std::vector<uint8_t> injected;
+    for (int s = 0; s < set_count; s++)
+    {
+        const std::vector<uint8_t>& set = *sets[s];
+        bool carried = false;
+        for (uint32_t i = key->first_nal; i < first_slice && !carried; i++)
+        {
+            carried = nals[i].size == set.size()
+                      && memcmp(data + nals[i].offset, set.data(), set.size()) == 0;
+        }
+        if (carried)
+        {
+            continue;
+        }
+        if (h.length_size > 0)
+        {
+            for (int b = h.length_size - 1; b >= 0; b--)
+            {
+                injected.push_back((set.size() >> (8 * b)) & 0xff);
+            }
+        }
+        else
+        {
+            injected.insert(injected.end(), {0x00, 0x00, 0x00, 0x01});
+        }
+        injected.insert(injected.end(), set.begin(), set.end());
+    }
+
+    // an access unit delimiter has to stay the first NAL unit
+    uint64_t cut_begin = key->offset;
+    uint64_t cut_end = last.offset + last.size;
+    uint64_t head_end = cut_begin;
+    const NalIndexNal& first = nals[key->first_nal];
+    if (!injected.empty() && first.size > 0 && classify_nal(codec, view_of(data, first)).aud)
+    {
+        // the first slice follows, so there is a next NAL unit
+        const NalIndexNal& next = nals[key->first_nal + 1];
+        head_end = next.offset - next.start_code_len;
+    }
+    if (!copy_range(in, fd, cut_begin, head_end - cut_begin)
+        || !write_all(fd, injected.data(), injected.size())
+        || !copy_range(in, fd, head_end, cut_end - head_end))
+    {
+        return false;
+    }
+    result->first_access_unit = key - access_units;
+    result->access_units = end - result->first_access_unit;
+    result->offset = cut_begin;
+    result->size = cut_end - cut_begin;
+    result->injected = injected.size();
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef __GOP_CUT_HPP__
+#define __GOP_CUT_HPP__
+
+#include <stdint.h>
+#include <string>
+#include "nal_index.hpp"
+
+// What cut_stream wrote.
+struct CutResult
+{
+    uint64_t first_access_unit;  // the keyframe the cut starts at
+    uint64_t access_units;
+    uint64_t offset;  // of the range copied from the stream
+    uint64_t size;
+    uint64_t injected;  // parameter set bytes written at the start of the keyframe
+};
+
+// Writes the access units [begin, end) of the indexed stream filename to fd, in the framing of
+// the stream. The cut starts earlier, at the last keyframe at or before begin, so the output
+// decodes from its first byte, and ends with access unit end - 1. The VPS/SPS/PPS the first slice
+// of the keyframe refers to are written at the start of its access unit, behind an access unit
+// delimiter if there is one and so ahead of any SEI, unless the access unit carries them already
+// in front of that slice (none if the stream never sent them before). Everything else is copied
+// by copy_file_range, or sendfile where the output is not a file copy_file_range can write to, so
+// the payload never passes through user space. Returns false for an empty range, a begin without
+// a keyframe in front of it, or a write error.
+bool cut_stream(const NalIndex& index, const std::string& filename, uint64_t begin, uint64_t end,
+                int fd, CutResult* result);
+
+#endif  // __GOP_CUT_HPP__
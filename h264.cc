@@ -0,0 +1,678 @@
+#include "h264.hpp"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "rbsp.hpp"
+
+// 7.3.2.1.1.1 Scaling list syntax
+void H264Parse::read_scaling_list(int *scaling_list, int size, uint8_t *use_default)
+{
+    int last_scale = 8;
+    int next_scale = 8;
+    *use_default = 0;
+    for (int j = 0; j < size; j++)
+    {
+        if (next_scale != 0)
+        {
+            int delta_scale = read_se();
+            next_scale = (last_scale + delta_scale + 256) % 256;
+            *use_default = (j == 0 && next_scale == 0);
+        }
+        scaling_list[j] = (next_scale == 0) ? last_scale : next_scale;
+        last_scale = scaling_list[j];
+    }
+}
+
+bool H264Parse::read_hrd(h264_hrd_t *hrd)
+{
+    hrd->cpb_cnt_minus1 = read_exponential_golomb_code();
+    if ((uint32_t)hrd->cpb_cnt_minus1 > 31)
+    {
+        return false;
+    }
+    hrd->bit_rate_scale = read_n_bits(4);
+    hrd->cpb_size_scale = read_n_bits(4);
+    for (int i = 0; i <= hrd->cpb_cnt_minus1; i++)
+    {
+        hrd->bit_rate_value_minus1[i] = read_exponential_golomb_code();
+        hrd->cpb_size_value_minus1[i] = read_exponential_golomb_code();
+        hrd->cbr_flag[i] = read_bit();
+    }
+    hrd->initial_cpb_removal_delay_length_minus1 = read_n_bits(5);
+    hrd->cpb_removal_delay_length_minus1 = read_n_bits(5);
+    hrd->dpb_output_delay_length_minus1 = read_n_bits(5);
+    hrd->time_offset_length = read_n_bits(5);
+    return true;
+}
+
+bool H264Parse::read_vui(h264_vui_t *vui)
+{
+    vui->aspect_ratio_info_present_flag = read_bit();
+    if (vui->aspect_ratio_info_present_flag)
+    {
+        vui->aspect_ratio_idc = read_n_bits(8);
+        if (vui->aspect_ratio_idc == 255)  // Extended_SAR
+        {
+            vui->sar_width = read_n_bits(16);
+            vui->sar_height = read_n_bits(16);
+        }
+    }
+    vui->overscan_info_present_flag = read_bit();
+    if (vui->overscan_info_present_flag)
+    {
+        vui->overscan_appropriate_flag = read_bit();
+    }
+    vui->video_signal_type_present_flag = read_bit();
+    if (vui->video_signal_type_present_flag)
+    {
+        vui->video_format = read_n_bits(3);
+        vui->video_full_range_flag = read_bit();
+        vui->colour_description_present_flag = read_bit();
+        if (vui->colour_description_present_flag)
+        {
+            vui->colour_primaries = read_n_bits(8);
+            vui->transfer_characteristics = read_n_bits(8);
+            vui->matrix_coefficients = read_n_bits(8);
+        }
+    }
+    vui->chroma_loc_info_present_flag = read_bit();
+    if (vui->chroma_loc_info_present_flag)
+    {
+        vui->chroma_sample_loc_type_top_field = read_exponential_golomb_code();
+        vui->chroma_sample_loc_type_bottom_field = read_exponential_golomb_code();
+    }
+    vui->timing_info_present_flag = read_bit();
+    if (vui->timing_info_present_flag)
+    {
+        vui->num_units_in_tick = read_n_bits(32);
+        vui->time_scale = read_n_bits(32);
+        vui->fixed_frame_rate_flag = read_bit();
+    }
+    vui->nal_hrd_parameters_present_flag = read_bit();
+    if (vui->nal_hrd_parameters_present_flag && !read_hrd(&vui->nal_hrd))
+    {
+        return false;
+    }
+    vui->vcl_hrd_parameters_present_flag = read_bit();
+    if (vui->vcl_hrd_parameters_present_flag && !read_hrd(&vui->vcl_hrd))
+    {
+        return false;
+    }
+    if (vui->nal_hrd_parameters_present_flag || vui->vcl_hrd_parameters_present_flag)
+    {
+        vui->low_delay_hrd_flag = read_bit();
+    }
+    vui->pic_struct_present_flag = read_bit();
+    vui->bitstream_restriction_flag = read_bit();
+    if (vui->bitstream_restriction_flag)
+    {
+        vui->motion_vectors_over_pic_boundaries_flag = read_bit();
+        vui->max_bytes_per_pic_denom = read_exponential_golomb_code();
+        vui->max_bits_per_mb_denom = read_exponential_golomb_code();
+        vui->log2_max_mv_length_horizontal = read_exponential_golomb_code();
+        vui->log2_max_mv_length_vertical = read_exponential_golomb_code();
+        vui->max_num_reorder_frames = read_exponential_golomb_code();
+        vui->max_dec_frame_buffering = read_exponential_golomb_code();
+    }
+    return true;
+}
+
+// Table A-1 MaxDpbMbs
+static int h264_max_dpb_mbs(const h264_sps_t *sps)
+{
+    switch (sps->level_idc)
+    {
+        case 9:  // level 1b
+        case 10:
+            return 396;
+        case 11:
+            // level 1b outside the high profiles
+            return sps->constraint_set3_flag && sps->profile_idc < 100 ? 396 : 900;
+        case 12:
+        case 13:
+        case 20:
+            return 2376;
+        case 21:
+            return 4752;
+        case 22:
+        case 30:
+            return 8100;
+        case 31:
+            return 18000;
+        case 32:
+            return 20480;
+        case 40:
+        case 41:
+            return 32768;
+        case 42:
+            return 34816;
+        case 50:
+            return 110400;
+        case 51:
+        case 52:
+            return 184320;
+        default:
+            return 696320;  // 6, 6.1, 6.2
+    }
+}
+
+bool H264Parse::read_sps(h264_sps_t *sps)
+{
+    sps->profile_idc = read_n_bits(8);
+    sps->constraint_set0_flag = read_bit();
+    sps->constraint_set1_flag = read_bit();
+    sps->constraint_set2_flag = read_bit();
+    sps->constraint_set3_flag = read_bit();
+    sps->constraint_set4_flag = read_bit();
+    sps->constraint_set5_flag = read_bit();
+    sps->reserved_zero_2bits = read_n_bits(2);
+    sps->level_idc = read_n_bits(8);
+    sps->seq_parameter_set_id = read_exponential_golomb_code();
+    if ((uint32_t)sps->seq_parameter_set_id > 31)
+    {
+        return false;
+    }
+
+    sps->chroma_format_idc = 1;  // 4:2:0 when not present
+    int profile_idc = sps->profile_idc;
+    if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244
+        || profile_idc == 44 || profile_idc == 83 || profile_idc == 86 || profile_idc == 118
+        || profile_idc == 128 || profile_idc == 138 || profile_idc == 139 || profile_idc == 134
+        || profile_idc == 135)
+    {
+        sps->chroma_format_idc = read_exponential_golomb_code();
+        if ((uint32_t)sps->chroma_format_idc > 3)
+        {
+            return false;
+        }
+        if (sps->chroma_format_idc == 3)
+        {
+            sps->separate_colour_plane_flag = read_bit();
+        }
+        sps->bit_depth_luma_minus8 = read_exponential_golomb_code();
+        sps->bit_depth_chroma_minus8 = read_exponential_golomb_code();
+        sps->qpprime_y_zero_transform_bypass_flag = read_bit();
+        sps->seq_scaling_matrix_present_flag = read_bit();
+        if (sps->seq_scaling_matrix_present_flag)
+        {
+            int lists = (sps->chroma_format_idc != 3) ? 8 : 12;
+            for (int i = 0; i < lists; i++)
+            {
+                sps->seq_scaling_list_present_flag[i] = read_bit();
+                if (!sps->seq_scaling_list_present_flag[i])
+                {
+                    continue;
+                }
+                if (i < 6)
+                {
+                    read_scaling_list(
+                        sps->ScalingList4x4[i], 16, &sps->UseDefaultScalingMatrix4x4Flag[i]);
+                }
+                else
+                {
+                    read_scaling_list(sps->ScalingList8x8[i - 6],
+                                      64,
+                                      &sps->UseDefaultScalingMatrix8x8Flag[i - 6]);
+                }
+            }
+        }
+    }
+
+    sps->log2_max_frame_num_minus4 = read_exponential_golomb_code();
+    sps->pic_order_cnt_type = read_exponential_golomb_code();
+    if ((uint32_t)sps->log2_max_frame_num_minus4 > 12 || (uint32_t)sps->pic_order_cnt_type > 2)
+    {
+        return false;
+    }
+    if (sps->pic_order_cnt_type == 0)
+    {
+        sps->log2_max_pic_order_cnt_lsb_minus4 = read_exponential_golomb_code();
+        if ((uint32_t)sps->log2_max_pic_order_cnt_lsb_minus4 > 12)
+        {
+            return false;
+        }
+    }
+    else if (sps->pic_order_cnt_type == 1)
+    {
+        sps->delta_pic_order_always_zero_flag = read_bit();
+        sps->offset_for_non_ref_pic = read_se();
+        sps->offset_for_top_to_bottom_field = read_se();
+        sps->num_ref_frames_in_pic_order_cnt_cycle = read_exponential_golomb_code();
+        if ((uint32_t)sps->num_ref_frames_in_pic_order_cnt_cycle > 255)
+        {
+            return false;
+        }
+        for (int i = 0; i < sps->num_ref_frames_in_pic_order_cnt_cycle; i++)
+        {
+            sps->offset_for_ref_frame[i] = read_se();
+        }
+    }
+    sps->max_num_ref_frames = read_exponential_golomb_code();
+    sps->gaps_in_frame_num_value_allowed_flag = read_bit();
+    sps->pic_width_in_mbs_minus1 = read_exponential_golomb_code();
+    sps->pic_height_in_map_units_minus1 = read_exponential_golomb_code();
+    sps->frame_mbs_only_flag = read_bit();
+    if (!sps->frame_mbs_only_flag)
+    {
+        sps->mb_adaptive_frame_field_flag = read_bit();
+    }
+    sps->direct_8x8_inference_flag = read_bit();
+    sps->frame_cropping_flag = read_bit();
+    if (sps->frame_cropping_flag)
+    {
+        sps->frame_crop_left_offset = read_exponential_golomb_code();
+        sps->frame_crop_right_offset = read_exponential_golomb_code();
+        sps->frame_crop_top_offset = read_exponential_golomb_code();
+        sps->frame_crop_bottom_offset = read_exponential_golomb_code();
+    }
+    sps->vui_parameters_present_flag = read_bit();
+    if (sps->vui_parameters_present_flag && !read_vui(&sps->vui))
+    {
+        return false;
+    }
+
+    // (7-13) - (7-22), the crop offsets count in chroma samples
+    int chroma_array_type = sps->separate_colour_plane_flag ? 0 : sps->chroma_format_idc;
+    int sub_width_c = (chroma_array_type == 1 || chroma_array_type == 2) ? 2 : 1;
+    int sub_height_c = (chroma_array_type == 1) ? 2 : 1;
+    int64_t crop_unit_x = chroma_array_type == 0 ? 1 : sub_width_c;
+    int64_t crop_unit_y = chroma_array_type == 0 ? 1 : sub_height_c;
+    crop_unit_y *= 2 - sps->frame_mbs_only_flag;
+    int64_t pic_width_in_mbs = (int64_t)(uint32_t)sps->pic_width_in_mbs_minus1 + 1;
+    int64_t pic_height_in_map_units = (int64_t)(uint32_t)sps->pic_height_in_map_units_minus1 + 1;
+    int64_t frame_height_in_mbs = (2 - sps->frame_mbs_only_flag) * pic_height_in_map_units;
+    int64_t crop_x = (int64_t)(uint32_t)sps->frame_crop_left_offset
+                     + (uint32_t)sps->frame_crop_right_offset;
+    int64_t crop_y = (int64_t)(uint32_t)sps->frame_crop_top_offset
+                     + (uint32_t)sps->frame_crop_bottom_offset;
+    sps->width = pic_width_in_mbs * 16 - crop_unit_x * crop_x;
+    sps->height = frame_height_in_mbs * 16 - crop_unit_y * crop_y;
+
+    h264_vui_t *vui = &sps->vui;
+    sps->framerate = 0;
+    if (vui->timing_info_present_flag && vui->num_units_in_tick != 0)
+    {
+        // a frame lasts two ticks (E-42)
+        sps->framerate = (double)vui->time_scale / (2.0 * vui->num_units_in_tick);
+    }
+    if (!vui->bitstream_restriction_flag)
+    {
+        // E.2.1
+        if ((profile_idc == 44 || profile_idc == 86 || profile_idc == 100 || profile_idc == 110
+             || profile_idc == 122 || profile_idc == 244)
+            && sps->constraint_set3_flag)
+        {
+            vui->max_num_reorder_frames = 0;
+            vui->max_dec_frame_buffering = 0;
+        }
+        else
+        {
+            int64_t frame_size_in_mbs = pic_width_in_mbs * frame_height_in_mbs;
+            int64_t max_dpb_frames
+                = h264_max_dpb_mbs(sps) / std::max<int64_t>(frame_size_in_mbs, 1);
+            vui->max_num_reorder_frames = (int)std::min<int64_t>(max_dpb_frames, 16);
+            vui->max_dec_frame_buffering = vui->max_num_reorder_frames;
+        }
+    }
+    return true;
+}
+
+// 7.2 more_rbsp_data(): anything but rbsp_stop_one_bit and alignment zero bits left
+bool H264Parse::more_rbsp_data() const
+{
+    uint64_t last = length_;
+    while (last > 0 && start_[last - 1] == 0)
+    {
+        last--;
+    }
+    if (last == 0)
+    {
+        return false;
+    }
+    uint64_t stop_bit = last * 8 - 1 - __builtin_ctz(start_[last - 1]);
+    return reader_.position() < stop_bit;
+}
+
+// Ceil(Log2(x))
+static int h264_ceil_log2(uint32_t x) { return x > 1 ? 32 - __builtin_clz(x - 1) : 0; }
+
+bool H264Parse::read_pps(h264_pps_t *pps, const h264_sps_t *sps)
+{
+    pps->pic_parameter_set_id = read_exponential_golomb_code();
+    pps->seq_parameter_set_id = read_exponential_golomb_code();
+    if ((uint32_t)pps->pic_parameter_set_id > 255 || (uint32_t)pps->seq_parameter_set_id > 31)
+    {
+        return false;
+    }
+    pps->entropy_coding_mode_flag = read_bit();
+    pps->bottom_field_pic_order_in_frame_present_flag = read_bit();
+    pps->num_slice_groups_minus1 = read_exponential_golomb_code();
+    if ((uint32_t)pps->num_slice_groups_minus1 > 7)
+    {
+        return false;
+    }
+    if (pps->num_slice_groups_minus1 > 0)
+    {
+        pps->slice_group_map_type = read_exponential_golomb_code();
+        if (pps->slice_group_map_type == 0)
+        {
+            for (int i = 0; i <= pps->num_slice_groups_minus1; i++)
+            {
+                pps->run_length_minus1[i] = read_exponential_golomb_code();
+            }
+        }
+        else if (pps->slice_group_map_type == 2)
+        {
+            for (int i = 0; i < pps->num_slice_groups_minus1; i++)
+            {
+                pps->top_left[i] = read_exponential_golomb_code();
+                pps->bottom_right[i] = read_exponential_golomb_code();
+            }
+        }
+        else if (pps->slice_group_map_type >= 3 && pps->slice_group_map_type <= 5)
+        {
+            pps->slice_group_change_direction_flag = read_bit();
+            pps->slice_group_change_rate_minus1 = read_exponential_golomb_code();
+        }
+        else if (pps->slice_group_map_type == 6)
+        {
+            pps->pic_size_in_map_units_minus1 = read_exponential_golomb_code();
+            int bits = h264_ceil_log2(pps->num_slice_groups_minus1 + 1);
+            uint64_t map_units = (uint64_t)(uint32_t)pps->pic_size_in_map_units_minus1 + 1;
+            reader_.skip_n_bits(bits * map_units);
+        }
+    }
+    pps->num_ref_idx_l0_default_active_minus1 = read_exponential_golomb_code();
+    pps->num_ref_idx_l1_default_active_minus1 = read_exponential_golomb_code();
+    pps->weighted_pred_flag = read_bit();
+    pps->weighted_bipred_idc = read_n_bits(2);
+    pps->pic_init_qp_minus26 = read_se();
+    pps->pic_init_qs_minus26 = read_se();
+    pps->chroma_qp_index_offset = read_se();
+    pps->deblocking_filter_control_present_flag = read_bit();
+    pps->constrained_intra_pred_flag = read_bit();
+    pps->redundant_pic_cnt_present_flag = read_bit();
+    pps->second_chroma_qp_index_offset = pps->chroma_qp_index_offset;
+    if (more_rbsp_data())
+    {
+        pps->transform_8x8_mode_flag = read_bit();
+        pps->pic_scaling_matrix_present_flag = read_bit();
+        if (pps->pic_scaling_matrix_present_flag)
+        {
+            int chroma_format_idc = sps ? sps->chroma_format_idc : 1;
+            int lists = 6 + ((chroma_format_idc != 3) ? 2 : 6) * pps->transform_8x8_mode_flag;
+            for (int i = 0; i < lists; i++)
+            {
+                pps->pic_scaling_list_present_flag[i] = read_bit();
+                if (!pps->pic_scaling_list_present_flag[i])
+                {
+                    continue;
+                }
+                if (i < 6)
+                {
+                    read_scaling_list(
+                        pps->ScalingList4x4[i], 16, &pps->UseDefaultScalingMatrix4x4Flag[i]);
+                }
+                else
+                {
+                    read_scaling_list(pps->ScalingList8x8[i - 6],
+                                      64,
+                                      &pps->UseDefaultScalingMatrix8x8Flag[i - 6]);
+                }
+            }
+        }
+        pps->second_chroma_qp_index_offset = read_se();
+    }
+    return true;
+}
+
+bool H264Parse::read_slice_header(h264_stream_t *h)
+{
+    h264_slice_header_t *sh = &h->sh;
+    sh->first_mb_in_slice = read_exponential_golomb_code();
+    sh->slice_type = read_exponential_golomb_code();
+    sh->pic_parameter_set_id = read_exponential_golomb_code();
+    h->pps = (uint32_t)sh->pic_parameter_set_id < 256 ? h->pps_table[sh->pic_parameter_set_id]
+                                                      : NULL;
+    h->sps = h->pps ? h->sps_table[h->pps->seq_parameter_set_id] : NULL;
+    if (!h->sps)
+    {
+        h->pps = NULL;
+        return false;
+    }
+    const h264_pps_t *pps = h->pps;
+    const h264_sps_t *sps = h->sps;
+
+    sh->colour_plane_id = 0;
+    if (sps->separate_colour_plane_flag)
+    {
+        sh->colour_plane_id = read_n_bits(2);
+    }
+    sh->frame_num = read_n_bits(sps->log2_max_frame_num_minus4 + 4);
+    sh->field_pic_flag = 0;
+    sh->bottom_field_flag = 0;
+    if (!sps->frame_mbs_only_flag)
+    {
+        sh->field_pic_flag = read_bit();
+        if (sh->field_pic_flag)
+        {
+            sh->bottom_field_flag = read_bit();
+        }
+    }
+    sh->idr_pic_id = 0;
+    if (h->nal.nal_unit_type == H264_NAL_UNIT_TYPE_CODED_SLICE_IDR)
+    {
+        sh->idr_pic_id = read_exponential_golomb_code();
+    }
+    sh->pic_order_cnt_lsb = 0;
+    sh->delta_pic_order_cnt_bottom = 0;
+    if (sps->pic_order_cnt_type == 0)
+    {
+        sh->pic_order_cnt_lsb = read_n_bits(sps->log2_max_pic_order_cnt_lsb_minus4 + 4);
+        if (pps->bottom_field_pic_order_in_frame_present_flag && !sh->field_pic_flag)
+        {
+            sh->delta_pic_order_cnt_bottom = read_se();
+        }
+    }
+    sh->delta_pic_order_cnt[0] = 0;
+    sh->delta_pic_order_cnt[1] = 0;
+    if (sps->pic_order_cnt_type == 1 && !sps->delta_pic_order_always_zero_flag)
+    {
+        sh->delta_pic_order_cnt[0] = read_se();
+        if (pps->bottom_field_pic_order_in_frame_present_flag && !sh->field_pic_flag)
+        {
+            sh->delta_pic_order_cnt[1] = read_se();
+        }
+    }
+    sh->redundant_pic_cnt = 0;
+    if (pps->redundant_pic_cnt_present_flag)
+    {
+        sh->redundant_pic_cnt = read_exponential_golomb_code();
+    }
+    return true;
+}
+
+h264_stream_t *h264_new() { return new h264_stream_t(); }
+
+void h264_free(h264_stream_t *h)
+{
+    if (!h)
+    {
+        return;
+    }
+    for (int i = 0; i < 32; i++)
+    {
+        delete h->sps_table[i];
+        param_set_key_free(&h->sps_keys[i]);
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        delete h->pps_table[i];
+        param_set_key_free(&h->pps_keys[i]);
+    }
+    free(h->rbsp_buf);
+    delete h;
+}
+
+static int h264_unescape(h264_stream_t *h, const uint8_t *p, int size)
+{
+    if (h->rbsp_buf_size < size)
+    {
+        h->rbsp_buf = (uint8_t *)realloc(h->rbsp_buf, size);
+        h->rbsp_buf_size = size;
+    }
+    return (int)unescape_rbsp(p, size, h->rbsp_buf, size);
+}
+
+static int h264_read_sps_nal(h264_stream_t *h, const uint8_t *p, int size)
+{
+    uint64_t hash = param_set_hash(p, size);
+    for (int i = 0; i < 32; i++)
+    {
+        if (h->sps_table[i] && param_set_key_equal(&h->sps_keys[i], hash, p, size))
+        {
+            h->param_set_cache.hits++;
+            h->sps = h->sps_table[i];
+            return 0;
+        }
+    }
+    h->param_set_cache.misses++;
+
+    // parsed aside so a broken SPS leaves the table alone
+    h264_sps_t sps = h264_sps_t();
+    int n = h264_unescape(h, p, size);
+    H264Parse parse(h->rbsp_buf, n);
+    if (!parse.read_sps(&sps) || parse.overrun())
+    {
+        return -1;
+    }
+    int id = sps.seq_parameter_set_id;
+    if (!h->sps_table[id])
+    {
+        h->sps_table[id] = new h264_sps_t();
+    }
+    *h->sps_table[id] = sps;
+    param_set_key_assign(&h->sps_keys[id], hash, p, size);
+    h->sps = h->sps_table[id];
+    // a PPS is parsed with the chroma format of its SPS, the cached ones may be stale now
+    for (int i = 0; i < 256; i++)
+    {
+        if (h->pps_table[i] && h->pps_table[i]->seq_parameter_set_id == id)
+        {
+            param_set_key_clear(&h->pps_keys[i]);
+        }
+    }
+    return 0;
+}
+
+static int h264_read_pps_nal(h264_stream_t *h, const uint8_t *p, int size)
+{
+    uint64_t hash = param_set_hash(p, size);
+    for (int i = 0; i < 256; i++)
+    {
+        if (h->pps_table[i] && param_set_key_equal(&h->pps_keys[i], hash, p, size))
+        {
+            h->param_set_cache.hits++;
+            h->pps = h->pps_table[i];
+            return 0;
+        }
+    }
+    h->param_set_cache.misses++;
+
+    h264_pps_t pps = h264_pps_t();
+    int n = h264_unescape(h, p, size);
+    // the sps id follows the pps id, the sps is needed for the scaling lists
+    ReadBit peek(h->rbsp_buf, n);
+    peek.read_ue();
+    uint32_t sps_id = peek.read_ue();
+    H264Parse parse(h->rbsp_buf, n);
+    if (!parse.read_pps(&pps, sps_id < 32 ? h->sps_table[sps_id] : NULL) || parse.overrun())
+    {
+        return -1;
+    }
+    int id = pps.pic_parameter_set_id;
+    if (!h->pps_table[id])
+    {
+        h->pps_table[id] = new h264_pps_t();
+    }
+    *h->pps_table[id] = pps;
+    param_set_key_assign(&h->pps_keys[id], hash, p, size);
+    h->pps = h->pps_table[id];
+    return 0;
+}
+
+// The slice header up to redundant_pic_cnt fits in a few bytes, so only the front of the slice
+// is unescaped. The whole slice is only unescaped if the header runs past the window.
+#define H264_SLICE_HEADER_WINDOW 64
+
+static int h264_read_slice_nal(h264_stream_t *h, const uint8_t *p, int size)
+{
+    int window = std::min(size, H264_SLICE_HEADER_WINDOW);
+    int n = h264_unescape(h, p, window);
+    if (window < size)
+    {
+        // the last two bytes may be the 00 00 of an emulation prevention cut off by the window
+        n -= 2;
+    }
+    H264Parse parse(h->rbsp_buf, n);
+    if (!parse.read_slice_header(h))
+    {
+        return -1;
+    }
+    if (!parse.overrun())
+    {
+        return 0;
+    }
+    if (window == size)
+    {
+        return -1;
+    }
+    n = h264_unescape(h, p, size);
+    H264Parse whole(h->rbsp_buf, n);
+    if (!whole.read_slice_header(h) || whole.overrun())
+    {
+        return -1;
+    }
+    return 0;
+}
+
+int h264_read_nal_unit(h264_stream_t *h, const uint8_t *buf, int size)
+{
+    if (size < 1)
+    {
+        return -1;
+    }
+    h264_nal_t *nal = &h->nal;
+    nal->forbidden_zero_bit = buf[0] >> 7;
+    nal->nal_ref_idc = (buf[0] >> 5) & 0x03;
+    nal->nal_unit_type = buf[0] & 0x1f;
+    if (nal->forbidden_zero_bit)
+    {
+        return -1;
+    }
+    switch (nal->nal_unit_type)
+    {
+        case H264_NAL_UNIT_TYPE_SPS:
+            if (h264_read_sps_nal(h, buf + 1, size - 1) < 0)
+            {
+                return -1;
+            }
+            break;
+        case H264_NAL_UNIT_TYPE_PPS:
+            if (h264_read_pps_nal(h, buf + 1, size - 1) < 0)
+            {
+                return -1;
+            }
+            break;
+        case H264_NAL_UNIT_TYPE_CODED_SLICE_NON_IDR:
+        case H264_NAL_UNIT_TYPE_CODED_SLICE_IDR:
+            if (h264_read_slice_nal(h, buf + 1, size - 1) < 0)
+            {
+                return -1;
+            }
+            break;
+        default:
+            break;
+    }
+    return size;
+}
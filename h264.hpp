@@ -4,207 +4,291 @@
 #include <assert.h>
 #include <stdint.h>
 #include "noncopyable.hpp"
+#include "param_set_cache.hpp"
+#include "read_bits.hpp"
 
+/**
+   HRD parameters
+   @see E.1.2 HRD parameters syntax
+*/
+typedef struct
+{
+    int cpb_cnt_minus1;
+    int bit_rate_scale;
+    int cpb_size_scale;
+    int bit_rate_value_minus1[32];
+    int cpb_size_value_minus1[32];
+    uint8_t cbr_flag[32];
+    int initial_cpb_removal_delay_length_minus1;
+    int cpb_removal_delay_length_minus1;
+    int dpb_output_delay_length_minus1;
+    int time_offset_length;
+} h264_hrd_t;
+
+/**
+   VUI parameters
+   @see E.1.1 VUI parameters syntax
+*/
+typedef struct
+{
+    uint8_t aspect_ratio_info_present_flag;
+    int aspect_ratio_idc;
+    int sar_width;
+    int sar_height;
+    uint8_t overscan_info_present_flag;
+    uint8_t overscan_appropriate_flag;
+    uint8_t video_signal_type_present_flag;
+    int video_format;
+    uint8_t video_full_range_flag;
+    uint8_t colour_description_present_flag;
+    int colour_primaries;
+    int transfer_characteristics;
+    int matrix_coefficients;
+    uint8_t chroma_loc_info_present_flag;
+    int chroma_sample_loc_type_top_field;
+    int chroma_sample_loc_type_bottom_field;
+    uint8_t timing_info_present_flag;
+    uint32_t num_units_in_tick;
+    uint32_t time_scale;
+    uint8_t fixed_frame_rate_flag;
+    uint8_t nal_hrd_parameters_present_flag;
+    h264_hrd_t nal_hrd;
+    uint8_t vcl_hrd_parameters_present_flag;
+    h264_hrd_t vcl_hrd;
+    uint8_t low_delay_hrd_flag;
+    uint8_t pic_struct_present_flag;
+    uint8_t bitstream_restriction_flag;
+    uint8_t motion_vectors_over_pic_boundaries_flag;
+    int max_bytes_per_pic_denom;
+    int max_bits_per_mb_denom;
+    int log2_max_mv_length_horizontal;
+    int log2_max_mv_length_vertical;
+    int max_num_reorder_frames;   // inferred when bitstream_restriction_flag is 0
+    int max_dec_frame_buffering;  // inferred when bitstream_restriction_flag is 0
+} h264_vui_t;
+
+/**
+   Sequence Parameter Set
+   @see 7.3.2.1.1 Sequence parameter set data syntax
+*/
+typedef struct
+{
+    int profile_idc;
+    uint8_t constraint_set0_flag;
+    uint8_t constraint_set1_flag;
+    uint8_t constraint_set2_flag;
+    uint8_t constraint_set3_flag;
+    uint8_t constraint_set4_flag;
+    uint8_t constraint_set5_flag;
+    int reserved_zero_2bits;
+    int level_idc;
+    int seq_parameter_set_id;
+    int chroma_format_idc;
+    uint8_t separate_colour_plane_flag;
+    int bit_depth_luma_minus8;
+    int bit_depth_chroma_minus8;
+    uint8_t qpprime_y_zero_transform_bypass_flag;
+    uint8_t seq_scaling_matrix_present_flag;
+    uint8_t seq_scaling_list_present_flag[12];
+    int ScalingList4x4[6][16];
+    int ScalingList8x8[6][64];
+    uint8_t UseDefaultScalingMatrix4x4Flag[6];
+    uint8_t UseDefaultScalingMatrix8x8Flag[6];
+    int log2_max_frame_num_minus4;
+    int pic_order_cnt_type;
+    int log2_max_pic_order_cnt_lsb_minus4;
+    uint8_t delta_pic_order_always_zero_flag;
+    int offset_for_non_ref_pic;
+    int offset_for_top_to_bottom_field;
+    int num_ref_frames_in_pic_order_cnt_cycle;
+    int offset_for_ref_frame[256];
+    int max_num_ref_frames;
+    uint8_t gaps_in_frame_num_value_allowed_flag;
+    int pic_width_in_mbs_minus1;
+    int pic_height_in_map_units_minus1;
+    uint8_t frame_mbs_only_flag;
+    uint8_t mb_adaptive_frame_field_flag;
+    uint8_t direct_8x8_inference_flag;
+    uint8_t frame_cropping_flag;
+    int frame_crop_left_offset;
+    int frame_crop_right_offset;
+    int frame_crop_top_offset;
+    int frame_crop_bottom_offset;
+    uint8_t vui_parameters_present_flag;
+    h264_vui_t vui;
+    // rbsp_trailing_bits( ) ...
+
+    // derived
+    int64_t width;  // cropped
+    int64_t height;
+    double framerate;  // 0 without timing info
+} h264_sps_t;
+
+/**
+   Picture Parameter Set
+   @see 7.3.2.2 Picture parameter set RBSP syntax
+*/
+typedef struct
+{
+    int pic_parameter_set_id;
+    int seq_parameter_set_id;
+    uint8_t entropy_coding_mode_flag;
+    uint8_t bottom_field_pic_order_in_frame_present_flag;
+    int num_slice_groups_minus1;
+    int slice_group_map_type;
+    int run_length_minus1[8];
+    int top_left[8];
+    int bottom_right[8];
+    uint8_t slice_group_change_direction_flag;
+    int slice_group_change_rate_minus1;
+    int pic_size_in_map_units_minus1;
+    // slice_group_id[] is skipped
+    int num_ref_idx_l0_default_active_minus1;
+    int num_ref_idx_l1_default_active_minus1;
+    uint8_t weighted_pred_flag;
+    int weighted_bipred_idc;
+    int pic_init_qp_minus26;
+    int pic_init_qs_minus26;
+    int chroma_qp_index_offset;
+    uint8_t deblocking_filter_control_present_flag;
+    uint8_t constrained_intra_pred_flag;
+    uint8_t redundant_pic_cnt_present_flag;
+    uint8_t transform_8x8_mode_flag;
+    uint8_t pic_scaling_matrix_present_flag;
+    uint8_t pic_scaling_list_present_flag[12];
+    int ScalingList4x4[6][16];
+    int ScalingList8x8[6][64];
+    uint8_t UseDefaultScalingMatrix4x4Flag[6];
+    uint8_t UseDefaultScalingMatrix8x8Flag[6];
+    int second_chroma_qp_index_offset;
+} h264_pps_t;
+
+/**
+   Slice header, up to redundant_pic_cnt
+   @see 7.3.3 Slice header syntax
+*/
+typedef struct
+{
+    int first_mb_in_slice;
+    int slice_type;
+    int pic_parameter_set_id;
+    int colour_plane_id;
+    int frame_num;
+    uint8_t field_pic_flag;
+    uint8_t bottom_field_flag;
+    int idr_pic_id;
+    int pic_order_cnt_lsb;
+    int delta_pic_order_cnt_bottom;
+    int delta_pic_order_cnt[2];
+    int redundant_pic_cnt;
+    // num_ref_idx_active_override_flag and everything after it are not parsed
+} h264_slice_header_t;
+
+typedef struct
+{
+    int forbidden_zero_bit;
+    int nal_ref_idc;
+    int nal_unit_type;
+} h264_nal_t;
+
+/**
+   H264 stream
+   Parameter sets are kept in tables by id, see h264_read_nal_unit.
+*/
+typedef struct
+{
+    h264_nal_t nal;
+    h264_sps_t* sps;
+    h264_pps_t* pps;
+    h264_slice_header_t sh;
+
+    h264_sps_t* sps_table[32];
+    h264_pps_t* pps_table[256];
+    // escaped payloads the table entries were parsed from
+    param_set_key_t sps_keys[32];
+    param_set_key_t pps_keys[256];
+    param_set_cache_stats_t param_set_cache;
+
+    // unescaped payload of the current NAL, reused for every NAL
+    uint8_t* rbsp_buf;
+    int rbsp_buf_size;
+} h264_stream_t;
+
+// Table 7-1 NAL unit type codes
+enum H264NalUnitType
+{
+    H264_NAL_UNIT_TYPE_UNSPECIFIED = 0,
+    H264_NAL_UNIT_TYPE_CODED_SLICE_NON_IDR = 1,
+    H264_NAL_UNIT_TYPE_CODED_SLICE_DATA_PARTITION_A = 2,
+    H264_NAL_UNIT_TYPE_CODED_SLICE_DATA_PARTITION_B = 3,
+    H264_NAL_UNIT_TYPE_CODED_SLICE_DATA_PARTITION_C = 4,
+    H264_NAL_UNIT_TYPE_CODED_SLICE_IDR = 5,
+    H264_NAL_UNIT_TYPE_SEI = 6,
+    H264_NAL_UNIT_TYPE_SPS = 7,
+    H264_NAL_UNIT_TYPE_PPS = 8,
+    H264_NAL_UNIT_TYPE_AUD = 9,
+    H264_NAL_UNIT_TYPE_END_OF_SEQUENCE = 10,
+    H264_NAL_UNIT_TYPE_END_OF_STREAM = 11,
+    H264_NAL_UNIT_TYPE_FILLER = 12,
+};
+
+// Table 7-6 Name association to slice_type, slice_type % 5
+enum H264SliceType
+{
+    H264_SLICE_TYPE_P = 0,
+    H264_SLICE_TYPE_B = 1,
+    H264_SLICE_TYPE_I = 2,
+    H264_SLICE_TYPE_SP = 3,
+    H264_SLICE_TYPE_SI = 4,
+};
+
+// Reads the syntax structures out of an unescaped payload.
 class H264Parse
 {
-#define UNUSE(x) (void)(x)
 private:
-    unsigned int read_bit()
-    {
-        assert(current_bit_ <= length_ * 8);
-        int index = current_bit_ / 8;
-        int offset = current_bit_ % 8 + 1;
-
-        current_bit_++;
-        return (start_[index] >> (8 - offset)) & 0x01;
-    }
-    unsigned int read_n_bits(int n)
-    {
-        int r = 0;
-        int i;
-        for (i = 0; i < n; i++)
-        {
-            r |= (read_bit() << (n - i - 1));
-        }
-        return r;
-    }
-
-    unsigned int read_exponential_golomb_code()
-    {
-        int r = 0;
-        int i = 0;
-
-        while ((read_bit() == 0) && (i < 32))
-        {
-            i++;
-        }
-
-        r = read_n_bits(i);
-        r += (1 << i) - 1;
-        return r;
-    }
-
-    unsigned int read_se()
-    {
-        int r = read_exponential_golomb_code();
-        if (r & 0x01)
-        {
-            r = (r + 1) / 2;
-        }
-        else
-        {
-            r = -(r / 2);
-        }
-        return r;
-    }
+    unsigned int read_bit() { return reader_.read_bit(); }
+    unsigned int read_n_bits(int n) { return reader_.read_n_bits(n); }
+    unsigned int read_exponential_golomb_code() { return reader_.read_ue(); }
+    int read_se() { return reader_.read_se(); }
 
 public:
     H264Parse(const uint8_t *start, uint64_t len)
-        : start_(start)
-        , length_(len)
-        , current_bit_(0) {};
+        : reader_(start, len)
+        , start_(start)
+        , length_(len) {};
 
 public:
-    void h264_width_height(int64_t *width, int64_t *height)
-    {
-
-        int frame_crop_left_offset = 0;
-        int frame_crop_right_offset = 0;
-        int frame_crop_top_offset = 0;
-        int frame_crop_bottom_offset = 0;
-
-        int profile_idc = read_n_bits(8);
-        UNUSE(profile_idc);
-        int constraint_set0_flag = read_bit();
-        UNUSE(constraint_set0_flag);
-        int constraint_set1_flag = read_bit();
-        UNUSE(constraint_set1_flag);
-        int constraint_set2_flag = read_bit();
-        UNUSE(constraint_set2_flag);
-        int constraint_set3_flag = read_bit();
-        UNUSE(constraint_set3_flag);
-        int constraint_set4_flag = read_bit();
-        UNUSE(constraint_set4_flag);
-        int constraint_set5_flag = read_bit();
-        UNUSE(constraint_set5_flag);
-        int reserved_zero_2bits = read_n_bits(2);
-        UNUSE(reserved_zero_2bits);
-        int level_idc = read_n_bits(8);
-        UNUSE(level_idc);
-        int seq_parameter_set_id = read_exponential_golomb_code();
-        UNUSE(seq_parameter_set_id);
-
-        if (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 244
-            || profile_idc == 44 || profile_idc == 83 || profile_idc == 86 || profile_idc == 118)
-        {
-            int chroma_format_idc = read_exponential_golomb_code();
-
-            if (chroma_format_idc == 3)
-            {
-                int residual_colour_transform_flag = read_bit();
-                UNUSE(residual_colour_transform_flag);
-            }
-            int bit_depth_luma_minus8 = read_exponential_golomb_code();
-            UNUSE(bit_depth_luma_minus8);
-            int bit_depth_chroma_minus8 = read_exponential_golomb_code();
-            UNUSE(bit_depth_chroma_minus8);
-            int qpprime_y_zero_transform_bypass_flag = read_bit();
-            UNUSE(qpprime_y_zero_transform_bypass_flag);
-            int seq_scaling_matrix_present_flag = read_bit();
-            UNUSE(seq_scaling_matrix_present_flag);
-
-            if (seq_scaling_matrix_present_flag)
-            {
-                int i = 0;
-                for (i = 0; i < 8; i++)
-                {
-                    int seq_scaling_list_present_flag = read_bit();
-                    if (seq_scaling_list_present_flag)
-                    {
-                        int sizeOfScalingList = (i < 6) ? 16 : 64;
-                        int lastScale = 8;
-                        int nextScale = 8;
-                        int j = 0;
-                        for (j = 0; j < sizeOfScalingList; j++)
-                        {
-                            if (nextScale != 0)
-                            {
-                                int delta_scale = read_se();
-                                nextScale = (lastScale + delta_scale + 256) % 256;
-                            }
-                            lastScale = (nextScale == 0) ? lastScale : nextScale;
-                        }
-                    }
-                }
-            }
-        }
-
-        int log2_max_frame_num_minus4 = read_exponential_golomb_code();
-        UNUSE(log2_max_frame_num_minus4);
-        int pic_order_cnt_type = read_exponential_golomb_code();
-        UNUSE(pic_order_cnt_type);
-        if (pic_order_cnt_type == 0)
-        {
-            int log2_max_pic_order_cnt_lsb_minus4 = read_exponential_golomb_code();
-            UNUSE(log2_max_pic_order_cnt_lsb_minus4);
-        }
-        else if (pic_order_cnt_type == 1)
-        {
-            int delta_pic_order_always_zero_flag = read_bit();
-            UNUSE(delta_pic_order_always_zero_flag);
-            int offset_for_non_ref_pic = read_se();
-            UNUSE(offset_for_non_ref_pic);
-            int offset_for_top_to_bottom_field = read_se();
-            UNUSE(offset_for_top_to_bottom_field);
-            int num_ref_frames_in_pic_order_cnt_cycle = read_exponential_golomb_code();
-            for (int i = 0; i < num_ref_frames_in_pic_order_cnt_cycle; i++)
-            {
-                read_se();
-                // sps->offset_for_ref_frame[ i ] = ReadSE();
-            }
-        }
-        int max_num_ref_frames = read_exponential_golomb_code();
-        UNUSE(max_num_ref_frames);
-        int gaps_in_frame_num_value_allowed_flag = read_bit();
-        UNUSE(gaps_in_frame_num_value_allowed_flag);
-        int pic_width_in_mbs_minus1 = read_exponential_golomb_code();
-        int pic_height_in_map_units_minus1 = read_exponential_golomb_code();
-        int frame_mbs_only_flag = read_bit();
-        if (!frame_mbs_only_flag)
-        {
-            int mb_adaptive_frame_field_flag = read_bit();
-            UNUSE(mb_adaptive_frame_field_flag);
-        }
-        int direct_8x8_inference_flag = read_bit();
-        UNUSE(direct_8x8_inference_flag);
-        int frame_cropping_flag = read_bit();
-        if (frame_cropping_flag)
-        {
-            frame_crop_left_offset = read_exponential_golomb_code();
-            frame_crop_right_offset = read_exponential_golomb_code();
-            frame_crop_top_offset = read_exponential_golomb_code();
-            frame_crop_bottom_offset = read_exponential_golomb_code();
-        }
-        int vui_parameters_present_flag = read_bit();
-        UNUSE(vui_parameters_present_flag);
-
-        *width = ((pic_width_in_mbs_minus1 + 1) * 16) - frame_crop_bottom_offset * 2
-                 - frame_crop_top_offset * 2;
-        *height = ((2 - frame_mbs_only_flag) * (pic_height_in_map_units_minus1 + 1) * 16)
-                  - (frame_crop_right_offset * 2) - (frame_crop_left_offset * 2);
-    }
+    // false if a value is out of range
+    bool read_sps(h264_sps_t *sps);
+    // sps is the one the pps refers to, NULL if it has not been received
+    bool read_pps(h264_pps_t *pps, const h264_sps_t *sps);
+    // false if the slice refers to a pps or sps missing from h's tables
+    bool read_slice_header(h264_stream_t *h);
+    // true if the reads went past the end of the payload
+    bool overrun() const { return reader_.position() > length_ * 8; }
     NONCOPYABLE(H264Parse);
 
 private:
+    void read_scaling_list(int *scaling_list, int size, uint8_t *use_default);
+    bool read_vui(h264_vui_t *vui);
+    bool read_hrd(h264_hrd_t *hrd);
+    bool more_rbsp_data() const;
+
+private:
+    ReadBit reader_;
     const uint8_t *start_;
     uint64_t length_;
-    uint64_t current_bit_;
 };
 
-void h264_width_height(const uint8_t *begin, uint64_t len, int64_t *width, int64_t *height)
-{
-    H264Parse parse(begin, len);
-    parse.h264_width_height(width, height);
-}
+// Parameter sets repeated byte for byte are only hashed and compared, which h->param_set_cache
+// counts as a hit.
+h264_stream_t *h264_new();
+void h264_free(h264_stream_t *h);
+
+// Parses one NAL unit (header byte included, no start code). h->nal and, depending on the type,
+// h->sps, h->pps or the slice header h->sh are updated. Only the first bytes of a slice are
+// unescaped. Returns size, or -1 if the NAL is broken or a slice refers to a parameter set that
+// has not been received.
+int h264_read_nal_unit(h264_stream_t *h, const uint8_t *buf, int size);
 
 #endif  // __H264_HPP__
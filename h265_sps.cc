@@ -1,4 +1,5 @@
 #include "h265_sps.hpp"
+#include <algorithm>
 
 void h265_read_ptl(profile_tier_level_t* ptl,
                    bs_t* b,
@@ -58,8 +59,6 @@ void h265_read_ptl(profile_tier_level_t* ptl,
         }
     }
     ptl->general_level_idc = bs_read_u8(b);
-    ptl->sub_layer_profile_present_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_level_present_flag.resize(max_sub_layers_minus1);
     for (i = 0; i < max_sub_layers_minus1; i++)
     {
         ptl->sub_layer_profile_present_flag[i] = bs_read_u1(b);
@@ -72,32 +71,6 @@ void h265_read_ptl(profile_tier_level_t* ptl,
             ptl->reserved_zero_2bits[i] = bs_read_u(b, 2);
         }
     }
-    ptl->sub_layer_profile_space.resize(max_sub_layers_minus1);
-    ptl->sub_layer_tier_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_profile_idc.resize(max_sub_layers_minus1);
-    ptl->sub_layer_profile_compatibility_flag.resize(max_sub_layers_minus1);
-    for (int j = 0; j < max_sub_layers_minus1; j++)
-    {
-        ptl->sub_layer_profile_compatibility_flag[j].resize(32);
-    }
-    ptl->sub_layer_progressive_source_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_interlaced_source_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_non_packed_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_frame_only_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_max_12bit_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_max_10bit_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_max_8bit_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_max_422chroma_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_max_420chroma_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_max_monochrome_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_intra_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_one_picture_only_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_lower_bit_rate_constraint_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_reserved_zero_34bits.resize(max_sub_layers_minus1);
-    ptl->sub_layer_reserved_zero_43bits.resize(max_sub_layers_minus1);
-    ptl->sub_layer_inbld_flag.resize(max_sub_layers_minus1);
-    ptl->sub_layer_reserved_zero_bit.resize(max_sub_layers_minus1);
-    ptl->sub_layer_level_idc.resize(max_sub_layers_minus1);
     for (i = 0; i < max_sub_layers_minus1; i++)
     {
         if (ptl->sub_layer_profile_present_flag[i])
@@ -171,24 +144,27 @@ void h265_read_short_term_ref_pic_set(
     {
         st->inter_ref_pic_set_prediction_flag = bs_read_u1(b);
     }
+    rps->m_interRPSPrediction = st->inter_ref_pic_set_prediction_flag;
+    rps->m_numberOfLongtermPictures = 0;
     if (st->inter_ref_pic_set_prediction_flag)
     {
         st->delta_idx_minus1 = 0;
-        if (stRpsIdx == sps->m_RPSList.size())
+        if (stRpsIdx == sps->num_short_term_ref_pic_sets)
         {
             st->delta_idx_minus1 = bs_read_ue(b);
         }
-        int rIdx = stRpsIdx - 1 - st->delta_idx_minus1;
+        int rIdx = std::max(stRpsIdx - 1 - st->delta_idx_minus1, 0);
         referencePictureSets_t* rpsRef = &sps->m_RPSList[rIdx];
 
         st->delta_rps_sign = bs_read_u1(b);
         st->abs_delta_rps_minus1 = bs_read_ue(b);
         int deltaRPS = (1 - 2 * st->delta_rps_sign) * (st->abs_delta_rps_minus1 + 1);  // delta_RPS
-        st->used_by_curr_pic_flag.resize(rpsRef->m_numberOfPictures + 1);
-        st->use_delta_flag.resize(rpsRef->m_numberOfPictures + 1);
+        int k = 0;
+        int k0 = 0;
         for (int j = 0; j <= rpsRef->m_numberOfPictures; j++)
         {
             st->used_by_curr_pic_flag[j] = bs_read_u1(b);
+            st->use_delta_flag[j] = 1;
             int refIdc = st->used_by_curr_pic_flag[j];
             if (!st->used_by_curr_pic_flag[j])
             {
@@ -196,35 +172,77 @@ void h265_read_short_term_ref_pic_set(
                 refIdc = st->use_delta_flag[j]
                          << 1;  // second bit is "1" if refIdc is 2, "0" if refIdc = 0.
             }
-            // todo furture
-            if (refIdc == 1 || refIdc == 2)
+            rps->m_refIdc[j] = refIdc;
+            // (7-61) (7-62), j == m_numberOfPictures stands for the reference picture itself
+            if ((refIdc == 1 || refIdc == 2) && k < MAX_NUM_REF_PICS)
             {
+                int deltaPOC = deltaRPS;
+                if (j < rpsRef->m_numberOfPictures)
+                {
+                    deltaPOC += rpsRef->m_deltaPOC[j];
+                }
+                rps->m_deltaPOC[k] = deltaPOC;
+                rps->m_used[k] = (refIdc == 1);
+                k0 += deltaPOC < 0;
+                k++;
+            }
+        }
+        rps->m_deltaRIdxMinus1 = st->delta_idx_minus1;
+        rps->m_deltaRPS = deltaRPS;
+        rps->m_numRefIdc = rpsRef->m_numberOfPictures + 1;
+        rps->m_numberOfPictures = k;
+        rps->m_numberOfNegativePictures = k0;
+        rps->m_numberOfPositivePictures = k - k0;
+
+        // negative pictures closest first, then positive pictures closest first
+        for (int i = 1; i < k; i++)
+        {
+            int deltaPOC = rps->m_deltaPOC[i];
+            int used = rps->m_used[i];
+            int j = i - 1;
+            for (; j >= 0 && rps->m_deltaPOC[j] > deltaPOC; j--)
+            {
+                rps->m_deltaPOC[j + 1] = rps->m_deltaPOC[j];
+                rps->m_used[j + 1] = rps->m_used[j];
             }
+            rps->m_deltaPOC[j + 1] = deltaPOC;
+            rps->m_used[j + 1] = used;
         }
+        std::reverse(rps->m_deltaPOC, rps->m_deltaPOC + k0);
+        std::reverse(rps->m_used, rps->m_used + k0);
     }
     else
     {
         st->num_negative_pics = bs_read_ue(b);
         st->num_positive_pics = bs_read_ue(b);
+        if (st->num_negative_pics > MAX_NUM_REF_PICS
+            || st->num_positive_pics > MAX_NUM_REF_PICS - st->num_negative_pics)
+        {
+            // corrupt
+            st->num_negative_pics = 0;
+            st->num_positive_pics = 0;
+        }
 
         rps->m_numberOfNegativePictures = st->num_negative_pics;
         rps->m_numberOfPositivePictures = st->num_positive_pics;
 
-        // to check...
-        st->delta_poc_s0_minus1.resize(st->num_negative_pics);
-        st->used_by_curr_pic_s0_flag.resize(st->num_negative_pics);
+        // (7-63) - (7-66)
+        int deltaPOC = 0;
         for (int i = 0; i < st->num_negative_pics; i++)
         {
             st->delta_poc_s0_minus1[i] = bs_read_ue(b);
             st->used_by_curr_pic_s0_flag[i] = bs_read_u1(b);
+            deltaPOC -= st->delta_poc_s0_minus1[i] + 1;
+            rps->m_deltaPOC[i] = deltaPOC;
             rps->m_used[i] = st->used_by_curr_pic_s0_flag[i];
         }
-        st->delta_poc_s1_minus1.resize(st->num_positive_pics);
-        st->used_by_curr_pic_s1_flag.resize(st->num_positive_pics);
+        deltaPOC = 0;
         for (int i = 0; i < st->num_positive_pics; i++)
         {
             st->delta_poc_s1_minus1[i] = bs_read_ue(b);
             st->used_by_curr_pic_s1_flag[i] = bs_read_u1(b);
+            deltaPOC += st->delta_poc_s1_minus1[i] + 1;
+            rps->m_deltaPOC[i + st->num_negative_pics] = deltaPOC;
             rps->m_used[i + st->num_negative_pics] = st->used_by_curr_pic_s1_flag[i];
         }
         rps->m_numberOfPictures = rps->m_numberOfNegativePictures + rps->m_numberOfPositivePictures;
@@ -267,11 +285,6 @@ void h265_read_sub_layer_hrd_parameters(sub_layer_hrd_parameters_t* subhrd,
                                         int sub_pic_hrd_params_present_flag,
                                         int CpbCnt)
 {
-    subhrd->bit_rate_value_minus1.resize(CpbCnt + 1);
-    subhrd->cpb_size_value_minus1.resize(CpbCnt + 1);
-    subhrd->cpb_size_du_value_minus1.resize(CpbCnt + 1);
-    subhrd->bit_rate_du_value_minus1.resize(CpbCnt + 1);
-    subhrd->cbr_flag.resize(CpbCnt + 1);
     for (int i = 0; i <= CpbCnt; i++)
     {
         subhrd->bit_rate_value_minus1[i] = bs_read_ue(b);
@@ -315,18 +328,16 @@ void h265_read_hrd_parameters(hrd_parameters_t* hrd,
             hrd->dpb_output_delay_length_minus1 = bs_read_u(b, 5);
         }
     }
-    hrd->fixed_pic_rate_general_flag.resize(maxNumSubLayersMinus1 + 1);
-    hrd->fixed_pic_rate_within_cvs_flag.resize(maxNumSubLayersMinus1 + 1);
-    hrd->elemental_duration_in_tc_minus1.resize(maxNumSubLayersMinus1 + 1);
-    hrd->low_delay_hrd_flag.resize(maxNumSubLayersMinus1 + 1);
-    hrd->cpb_cnt_minus1.resize(maxNumSubLayersMinus1 + 1);
     for (int i = 0; i <= maxNumSubLayersMinus1; i++)
     {
         hrd->fixed_pic_rate_general_flag[i] = bs_read_u1(b);
+        // inferred to be 1 when fixed_pic_rate_general_flag is 1
+        hrd->fixed_pic_rate_within_cvs_flag[i] = 1;
         if (!hrd->fixed_pic_rate_general_flag[i])
         {
             hrd->fixed_pic_rate_within_cvs_flag[i] = bs_read_u1(b);
         }
+        hrd->low_delay_hrd_flag[i] = 0;
         if (hrd->fixed_pic_rate_within_cvs_flag[i])
         {
             hrd->elemental_duration_in_tc_minus1[i] = bs_read_ue(b);
@@ -335,9 +346,15 @@ void h265_read_hrd_parameters(hrd_parameters_t* hrd,
         {
             hrd->low_delay_hrd_flag[i] = bs_read_u1(b);
         }
+        hrd->cpb_cnt_minus1[i] = 0;
         if (!hrd->low_delay_hrd_flag[i])
         {
-            hrd->cpb_cnt_minus1[i] = bs_read_u1(b);
+            hrd->cpb_cnt_minus1[i] = bs_read_ue(b);
+            if (hrd->cpb_cnt_minus1[i] > 31)
+            {
+                // corrupt
+                hrd->cpb_cnt_minus1[i] = 0;
+            }
         }
         if (hrd->nal_hrd_parameters_present_flag)
         {
@@ -441,28 +458,26 @@ void h265_read_sps_rbsp(h265_sps_t* sps, bs_t* b)
     int sps_max_sub_layers_minus1 = 0;
     int sps_temporal_id_nesting_flag = 0;
     int sps_seq_parameter_set_id = 0;
-    profile_tier_level_t profile_tier_level;
+    profile_tier_level_t profile_tier_level = profile_tier_level_t();
 
     sps_video_parameter_set_id = bs_read_u(b, 4);
     sps_max_sub_layers_minus1 = bs_read_u(b, 3);
     sps_temporal_id_nesting_flag = bs_read_u1(b);
 
     // profile tier level...
-    memset(&profile_tier_level, '\0', sizeof(profile_tier_level_t));
-
     h265_read_ptl(&profile_tier_level, b, 1, sps_max_sub_layers_minus1);
 
     sps_seq_parameter_set_id = bs_read_ue(b);
     // 选择正确的sps表
     // h->sps = h->sps_table[sps_seq_parameter_set_id];
     // h265_sps_t* sps = h->sps;
-    memset(sps, 0, sizeof(h265_sps_t));
+    *sps = h265_sps_t();
 
     sps->sps_video_parameter_set_id = sps_video_parameter_set_id;
     sps->sps_max_sub_layers_minus1 = sps_max_sub_layers_minus1;
     sps->sps_temporal_id_nesting_flag = sps_temporal_id_nesting_flag;
 
-    memcpy(&(sps->ptl), &profile_tier_level, sizeof(profile_tier_level_t));  // ptl
+    sps->ptl = profile_tier_level;  // ptl
 
     sps->sps_seq_parameter_set_id = sps_seq_parameter_set_id;
     sps->chroma_format_idc = bs_read_ue(b);
@@ -554,9 +569,11 @@ void h265_read_sps_rbsp(h265_sps_t* sps, bs_t* b)
     }
 
     sps->num_short_term_ref_pic_sets = bs_read_ue(b);
-    // 根据num_short_term_ref_pic_sets创建数组
-    sps->st_ref_pic_set.resize(sps->num_short_term_ref_pic_sets);
-    sps->m_RPSList.resize(sps->num_short_term_ref_pic_sets);  // 确定一共有多少个RPS列表
+    if (sps->num_short_term_ref_pic_sets > 64)
+    {
+        // corrupt
+        sps->num_short_term_ref_pic_sets = 0;
+    }
     referencePictureSets_t* rps = NULL;
     st_ref_pic_set_t* st = NULL;
     for (int i = 0; i < sps->num_short_term_ref_pic_sets; i++)
@@ -570,8 +587,11 @@ void h265_read_sps_rbsp(h265_sps_t* sps, bs_t* b)
     if (sps->long_term_ref_pics_present_flag)
     {
         sps->num_long_term_ref_pics_sps = bs_read_ue(b);
-        sps->lt_ref_pic_poc_lsb_sps.resize(sps->num_long_term_ref_pics_sps);
-        sps->used_by_curr_pic_lt_sps_flag.resize(sps->num_long_term_ref_pics_sps);
+        if (sps->num_long_term_ref_pics_sps > 32)
+        {
+            // corrupt
+            sps->num_long_term_ref_pics_sps = 0;
+        }
         for (int i = 0; i < sps->num_long_term_ref_pics_sps; i++)
         {
             sps->lt_ref_pic_poc_lsb_sps_bytes = sps->log2_max_pic_order_cnt_lsb_minus4 + 4;
@@ -647,6 +667,1009 @@ void h265_read_rbsp_trailing_bits(bs_t* b)
     }
 }
 
+h265_stream_t* h265_new()
+{
+    h265_stream_t* h = new h265_stream_t();
+    h->nal = new h265_nal_t();
+    h->aud = new h265_aud_t();
+    h->sh = new h265_slice_header_t();
+    h->slice_data = new h265_slice_data_rbsp_t();
+    return h;
+}
+
+void h265_free(h265_stream_t* h)
+{
+    if (!h)
+    {
+        return;
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        delete h->vps_table[i];
+    }
+    for (int i = 0; i < 32; i++)
+    {
+        delete h->sps_table[i];
+    }
+    for (int i = 0; i < 256; i++)
+    {
+        delete h->pps_table[i];
+    }
+    for (int i = 0; i < h->seis_capacity; i++)
+    {
+        delete h->seis[i];
+    }
+    for (int i = 0; i < 16; i++)
+    {
+        param_set_key_free(&h->vps_keys[i]);
+        param_set_key_free(&h->sps_keys[i]);
+    }
+    for (int i = 0; i < 64; i++)
+    {
+        param_set_key_free(&h->pps_keys[i]);
+    }
+    free(h->seis);
+    free(h->rbsp_buf);
+    delete h->nal;
+    delete h->aud;
+    delete h->sh;
+    delete h->slice_data;
+    delete h;
+}
+
+// Points h->vps, h->sps or h->pps at the table entry that was parsed from exactly this payload.
+static int h265_find_param_set(h265_stream_t* h, uint64_t hash, const uint8_t* p, int size)
+{
+    h265_nal_t* nal = h->nal;
+    switch (nal->nal_unit_type)
+    {
+        case NAL_UNIT_VPS:
+            for (int i = 0; i < 16; i++)
+            {
+                if (h->vps_table[i] && param_set_key_equal(&h->vps_keys[i], hash, p, size))
+                {
+                    h->vps = h->vps_table[i];
+                    nal->parsed = h->vps;
+                    nal->sizeof_parsed = sizeof(h265_vps_t);
+                    return 1;
+                }
+            }
+            break;
+        case NAL_UNIT_SPS:
+            for (int i = 0; i < 16; i++)
+            {
+                if (h->sps_table[i] && param_set_key_equal(&h->sps_keys[i], hash, p, size))
+                {
+                    h->sps = h->sps_table[i];
+                    nal->parsed = h->sps;
+                    nal->sizeof_parsed = sizeof(h265_sps_t);
+                    return 1;
+                }
+            }
+            break;
+        case NAL_UNIT_PPS:
+            for (int i = 0; i < 64; i++)
+            {
+                if (h->pps_table[i] && param_set_key_equal(&h->pps_keys[i], hash, p, size))
+                {
+                    h->pps = h->pps_table[i];
+                    nal->parsed = h->pps;
+                    nal->sizeof_parsed = sizeof(h265_pps_t);
+                    return 1;
+                }
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+// the key of the parameter set h265_read_nal_unit has just parsed
+static param_set_key_t* h265_param_set_key(h265_stream_t* h)
+{
+    switch (h->nal->nal_unit_type)
+    {
+        case NAL_UNIT_VPS:
+            return &h->vps_keys[h->vps->vps_video_parameter_set_id];
+        case NAL_UNIT_SPS:
+            return &h->sps_keys[h->sps->sps_seq_parameter_set_id];
+        default:
+            return &h->pps_keys[h->pps->pps_pic_parameter_set_id];
+    }
+}
+
+int h265_read_nal_unit(h265_stream_t* h, uint8_t* buf, int size)
+{
+    if (size < 2)
+    {
+        return -1;
+    }
+    h265_nal_t* nal = h->nal;
+    bs_t b;
+    bs_init(&b, buf, 2);
+    nal->forbidden_zero_bit = bs_read_f(&b, 1);
+    nal->nal_unit_type = bs_read_u(&b, 6);
+    nal->nuh_layer_id = bs_read_u(&b, 6);
+    nal->nuh_temporal_id_plus1 = bs_read_u(&b, 3);
+    nal->parsed = NULL;
+    nal->sizeof_parsed = 0;
+    if (nal->forbidden_zero_bit != 0 || nal->nuh_temporal_id_plus1 == 0)
+    {
+        return -1;
+    }
+
+    int param_set = nal->nal_unit_type >= NAL_UNIT_VPS && nal->nal_unit_type <= NAL_UNIT_PPS;
+    uint64_t hash = 0;
+    if (param_set)
+    {
+        hash = param_set_hash(buf + 2, size - 2);
+        if (h265_find_param_set(h, hash, buf + 2, size - 2))
+        {
+            h->param_set_cache.hits++;
+            return size;
+        }
+        h->param_set_cache.misses++;
+    }
+
+    if (h->rbsp_buf_size < size)
+    {
+        h->rbsp_buf = (uint8_t*)realloc(h->rbsp_buf, size);
+        h->rbsp_buf_size = size;
+    }
+    // only the bytes a parser reads get unescaped
+    bs_init_ebsp(&b, h->rbsp_buf, buf + 2, size - 2);
+
+    switch (nal->nal_unit_type)
+    {
+        case NAL_UNIT_VPS:
+            h265_read_vps_rbsp(h, &b);
+            nal->parsed = h->vps;
+            nal->sizeof_parsed = sizeof(h265_vps_t);
+            break;
+        case NAL_UNIT_SPS:
+        {
+            // the table entry is only known after the profile_tier_level in front of the id
+            bs_t peek;
+            bs_clone(&peek, &b);
+            bs_skip_u(&peek, 4);
+            int sps_max_sub_layers_minus1 = bs_read_u(&peek, 3);
+            bs_skip_u(&peek, 1);
+            profile_tier_level_t ptl = profile_tier_level_t();
+            h265_read_ptl(&ptl, &peek, 1, sps_max_sub_layers_minus1);
+            uint32_t sps_id = bs_read_ue(&peek);
+            if (sps_id >= 16)
+            {
+                return -1;
+            }
+            if (!h->sps_table[sps_id])
+            {
+                h->sps_table[sps_id] = new h265_sps_t();
+            }
+            h->sps = h->sps_table[sps_id];
+            h265_read_sps_rbsp(h->sps, &b);
+            nal->parsed = h->sps;
+            nal->sizeof_parsed = sizeof(h265_sps_t);
+            break;
+        }
+        case NAL_UNIT_PPS:
+            h->pps = NULL;
+            h265_read_pps_rbsp(h, &b);
+            if (!h->pps)
+            {
+                return -1;
+            }
+            nal->parsed = h->pps;
+            nal->sizeof_parsed = sizeof(h265_pps_t);
+            break;
+        case NAL_UNIT_AUD:
+            h265_read_aud_rbsp(h, &b);
+            nal->parsed = h->aud;
+            nal->sizeof_parsed = sizeof(h265_aud_t);
+            break;
+        case NAL_UNIT_EOS:
+            h265_read_end_of_seq_rbsp(h, &b);
+            break;
+        case NAL_UNIT_EOB:
+            h265_read_end_of_stream_rbsp(h, &b);
+            break;
+        case NAL_UNIT_PREFIX_SEI:
+        case NAL_UNIT_SUFFIX_SEI:
+            h265_read_sei_rbsp(h, &b);
+            nal->parsed = h->sei;
+            nal->sizeof_parsed = sizeof(h265_sei_t);
+            break;
+        default:
+            if (nal->nal_unit_type <= NAL_UNIT_CODED_SLICE_RASL_R
+                || (nal->nal_unit_type >= NAL_UNIT_CODED_SLICE_BLA_W_LP
+                    && nal->nal_unit_type <= NAL_UNIT_CODED_SLICE_CRA))
+            {
+                h265_read_slice_layer_rbsp(h, &b);
+                if (!h->pps)
+                {
+                    return -1;
+                }
+                nal->parsed = h->sh;
+                nal->sizeof_parsed = sizeof(h265_slice_header_t);
+            }
+            break;
+    }
+    int overrun = bs_overrun(&b);
+    if (param_set)
+    {
+        // a broken parameter set leaves its table entry half parsed
+        param_set_key_t* key = h265_param_set_key(h);
+        if (overrun)
+        {
+            param_set_key_clear(key);
+        }
+        else
+        {
+            param_set_key_assign(key, hash, buf + 2, size - 2);
+        }
+    }
+    if (overrun)
+    {
+        return -1;
+    }
+    return size;
+}
+
+void h265_read_vps_rbsp(h265_stream_t* h, bs_t* b)
+{
+    int vps_video_parameter_set_id = bs_read_u(b, 4);
+    if (!h->vps_table[vps_video_parameter_set_id])
+    {
+        h->vps_table[vps_video_parameter_set_id] = new h265_vps_t();
+    }
+    h265_vps_t* vps = h->vps_table[vps_video_parameter_set_id];
+    h->vps = vps;
+    *vps = h265_vps_t();
+
+    vps->vps_video_parameter_set_id = vps_video_parameter_set_id;
+    vps->vps_base_layer_internal_flag = bs_read_u1(b);
+    vps->vps_base_layer_available_flag = bs_read_u1(b);
+    vps->vps_max_layers_minus1 = bs_read_u(b, 6);
+    vps->vps_max_sub_layers_minus1 = bs_read_u(b, 3);
+    vps->vps_temporal_id_nesting_flag = bs_read_u1(b);
+    vps->vps_reserved_0xffff_16bits = bs_read_u(b, 16);
+
+    h265_read_ptl(&vps->ptl, b, 1, vps->vps_max_sub_layers_minus1);
+
+    vps->vps_sub_layer_ordering_info_present_flag = bs_read_u1(b);
+    for (int i
+         = (vps->vps_sub_layer_ordering_info_present_flag ? 0 : vps->vps_max_sub_layers_minus1);
+         i <= vps->vps_max_sub_layers_minus1;
+         i++)
+    {
+        vps->vps_max_dec_pic_buffering_minus1[i] = bs_read_ue(b);
+        vps->vps_max_num_reorder_pics[i] = bs_read_ue(b);
+        vps->vps_max_latency_increase_plus1[i] = bs_read_ue(b);
+    }
+
+    vps->vps_max_layer_id = bs_read_u(b, 6);
+    vps->vps_num_layer_sets_minus1 = bs_read_ue(b);
+    if (vps->vps_num_layer_sets_minus1 > 1023)
+    {
+        return;
+    }
+    for (int i = 1; i <= vps->vps_num_layer_sets_minus1; i++)
+    {
+        for (int j = 0; j <= vps->vps_max_layer_id; j++)
+        {
+            vps->layer_id_included_flag[i][j] = bs_read_u1(b);
+        }
+    }
+
+    vps->vps_timing_info_present_flag = bs_read_u1(b);
+    if (vps->vps_timing_info_present_flag)
+    {
+        vps->vps_num_units_in_tick = bs_read_u(b, 32);
+        vps->vps_time_scale = bs_read_u(b, 32);
+        vps->vps_poc_proportional_to_timing_flag = bs_read_u1(b);
+        if (vps->vps_poc_proportional_to_timing_flag)
+        {
+            vps->vps_num_ticks_poc_diff_one_minus1 = bs_read_ue(b);
+        }
+        vps->vps_num_hrd_parameters = bs_read_ue(b);
+        if (vps->vps_num_hrd_parameters > vps->vps_num_layer_sets_minus1 + 1)
+        {
+            return;
+        }
+        for (int i = 0; i < vps->vps_num_hrd_parameters; i++)
+        {
+            vps->hrd_layer_set_idx[i] = bs_read_ue(b);
+            // cprms_present_flag[0] is inferred to be 1
+            vps->cprms_present_flag[i] = 1;
+            if (i > 0)
+            {
+                vps->cprms_present_flag[i] = bs_read_u1(b);
+            }
+            // only the last hrd_parameters() is kept
+            h265_read_hrd_parameters(&vps->hrd_parameters,
+                                     b,
+                                     vps->cprms_present_flag[i],
+                                     vps->vps_max_sub_layers_minus1);
+        }
+    }
+
+    vps->vps_extension_flag = bs_read_u1(b);
+    if (vps->vps_extension_flag)
+    {
+        while (h265_more_rbsp_trailing_data(b))
+        {
+            vps->vps_extension_data_flag = bs_read_u1(b);
+        }
+    }
+    h265_read_rbsp_trailing_bits(b);
+}
+
+static void h265_read_pps_range_extension(pps_range_extension_t* pps_range_ext,
+                                          h265_pps_t* pps,
+                                          bs_t* b)
+{
+    if (pps->transform_skip_enabled_flag)
+    {
+        pps_range_ext->log2_max_transform_skip_block_size_minus2 = bs_read_ue(b);
+    }
+    pps_range_ext->cross_component_prediction_enabled_flag = bs_read_u1(b);
+    pps_range_ext->chroma_qp_offset_list_enabled_flag = bs_read_u1(b);
+    if (pps_range_ext->chroma_qp_offset_list_enabled_flag)
+    {
+        pps_range_ext->diff_cu_chroma_qp_offset_depth = bs_read_ue(b);
+        pps_range_ext->chroma_qp_offset_list_len_minus1 = bs_read_ue(b);
+        if (pps_range_ext->chroma_qp_offset_list_len_minus1 > 5)
+        {
+            return;
+        }
+        for (int i = 0; i <= pps_range_ext->chroma_qp_offset_list_len_minus1; i++)
+        {
+            pps_range_ext->cb_qp_offset_list[i] = bs_read_se(b);
+            pps_range_ext->cr_qp_offset_list[i] = bs_read_se(b);
+        }
+    }
+    pps_range_ext->log2_sao_offset_scale_luma = bs_read_ue(b);
+    pps_range_ext->log2_sao_offset_scale_chroma = bs_read_ue(b);
+}
+
+void h265_read_pps_rbsp(h265_stream_t* h, bs_t* b)
+{
+    uint32_t pps_pic_parameter_set_id = bs_read_ue(b);
+    if (pps_pic_parameter_set_id >= 64)
+    {
+        return;
+    }
+    if (!h->pps_table[pps_pic_parameter_set_id])
+    {
+        h->pps_table[pps_pic_parameter_set_id] = new h265_pps_t();
+    }
+    h265_pps_t* pps = h->pps_table[pps_pic_parameter_set_id];
+    h->pps = pps;
+    *pps = h265_pps_t();
+
+    pps->pps_pic_parameter_set_id = pps_pic_parameter_set_id;
+    pps->pps_seq_parameter_set_id = bs_read_ue(b);
+    pps->dependent_slice_segments_enabled_flag = bs_read_u1(b);
+    pps->output_flag_present_flag = bs_read_u1(b);
+    pps->num_extra_slice_header_bits = bs_read_u(b, 3);
+    pps->sign_data_hiding_enabled_flag = bs_read_u1(b);
+    pps->cabac_init_present_flag = bs_read_u1(b);
+    pps->num_ref_idx_l0_default_active_minus1 = bs_read_ue(b);
+    pps->num_ref_idx_l1_default_active_minus1 = bs_read_ue(b);
+    pps->init_qp_minus26 = bs_read_se(b);
+    pps->constrained_intra_pred_flag = bs_read_u1(b);
+    pps->transform_skip_enabled_flag = bs_read_u1(b);
+    pps->cu_qp_delta_enabled_flag = bs_read_u1(b);
+    if (pps->cu_qp_delta_enabled_flag)
+    {
+        pps->diff_cu_qp_delta_depth = bs_read_ue(b);
+    }
+    pps->pps_cb_qp_offset = bs_read_se(b);
+    pps->pps_cr_qp_offset = bs_read_se(b);
+    pps->pps_slice_chroma_qp_offsets_present_flag = bs_read_u1(b);
+    pps->weighted_pred_flag = bs_read_u1(b);
+    pps->weighted_bipred_flag = bs_read_u1(b);
+    pps->transquant_bypass_enabled_flag = bs_read_u1(b);
+    pps->tiles_enabled_flag = bs_read_u1(b);
+    pps->entropy_coding_sync_enabled_flag = bs_read_u1(b);
+    if (pps->tiles_enabled_flag)
+    {
+        pps->num_tile_columns_minus1 = bs_read_ue(b);
+        pps->num_tile_rows_minus1 = bs_read_ue(b);
+        // at most 20 x 22 tiles (Table A.8)
+        if (pps->num_tile_columns_minus1 >= 20 || pps->num_tile_rows_minus1 >= 22)
+        {
+            return;
+        }
+        pps->uniform_spacing_flag = bs_read_u1(b);
+        if (!pps->uniform_spacing_flag)
+        {
+            for (int i = 0; i < pps->num_tile_columns_minus1; i++)
+            {
+                pps->column_width_minus1[i] = bs_read_ue(b);
+            }
+            for (int i = 0; i < pps->num_tile_rows_minus1; i++)
+            {
+                pps->row_height_minus1[i] = bs_read_ue(b);
+            }
+        }
+        pps->loop_filter_across_tiles_enabled_flag = bs_read_u1(b);
+    }
+    pps->pps_loop_filter_across_slices_enabled_flag = bs_read_u1(b);
+    pps->deblocking_filter_control_present_flag = bs_read_u1(b);
+    if (pps->deblocking_filter_control_present_flag)
+    {
+        pps->deblocking_filter_override_enabled_flag = bs_read_u1(b);
+        pps->pps_deblocking_filter_disabled_flag = bs_read_u1(b);
+        if (!pps->pps_deblocking_filter_disabled_flag)
+        {
+            pps->pps_beta_offset_div2 = bs_read_se(b);
+            pps->pps_tc_offset_div2 = bs_read_se(b);
+        }
+    }
+    pps->pps_scaling_list_data_present_flag = bs_read_u1(b);
+    if (pps->pps_scaling_list_data_present_flag)
+    {
+        h265_read_scaling_list(&pps->scaling_list_data, b);
+    }
+    pps->lists_modification_present_flag = bs_read_u1(b);
+    pps->log2_parallel_merge_level_minus2 = bs_read_ue(b);
+    pps->slice_segment_header_extension_present_flag = bs_read_u1(b);
+    pps->pps_extension_present_flag = bs_read_u1(b);
+    if (pps->pps_extension_present_flag)
+    {
+        pps->pps_range_extension_flag = bs_read_u1(b);
+        pps->pps_multilayer_extension_flag = bs_read_u1(b);
+        pps->pps_3d_extension_flag = bs_read_u1(b);
+        pps->pps_extension_5bits = bs_read_u(b, 5);
+    }
+    if (pps->pps_range_extension_flag)
+    {
+        h265_read_pps_range_extension(&pps->pps_range_extension, pps, b);
+    }
+    if (pps->pps_multilayer_extension_flag || pps->pps_3d_extension_flag)
+    {
+        // todo pps_multilayer_extension( ) pps_3d_extension( ), nothing after them is known
+        return;
+    }
+    if (pps->pps_extension_5bits)
+    {
+        while (h265_more_rbsp_trailing_data(b))
+        {
+            pps->pps_extension_data_flag = bs_read_u1(b);
+        }
+    }
+    h265_read_rbsp_trailing_bits(b);
+}
+
+void h265_read_aud_rbsp(h265_stream_t* h, bs_t* b)
+{
+    h->aud->pic_type = bs_read_u(b, 3);
+    h265_read_rbsp_trailing_bits(b);
+}
+
+void h265_read_end_of_seq_rbsp(h265_stream_t* h, bs_t* b)
+{
+    (void)h;
+    (void)b;
+}
+
+void h265_read_end_of_stream_rbsp(h265_stream_t* h, bs_t* b)
+{
+    (void)h;
+    (void)b;
+}
+
+// Ceil(Log2(x))
+static int h265_ceil_log2(uint32_t x)
+{
+    return x > 1 ? 32 - __builtin_clz(x - 1) : 0;
+}
+
+// 7.3.6.3 Weighted prediction parameters syntax
+static void h265_read_pred_weight_table_list(pred_weight_table_t* pwt,
+                                             bs_t* b,
+                                             int num_ref_idx_active_minus1,
+                                             int chroma,
+                                             int list)
+{
+    uint8_t* luma_weight_flag = list ? pwt->luma_weight_l1_flag : pwt->luma_weight_l0_flag;
+    uint8_t* chroma_weight_flag = list ? pwt->chroma_weight_l1_flag : pwt->chroma_weight_l0_flag;
+    int* delta_luma_weight = list ? pwt->delta_luma_weight_l1 : pwt->delta_luma_weight_l0;
+    int* luma_offset = list ? pwt->luma_offset_l1 : pwt->luma_offset_l0;
+    int(*delta_chroma_weight)[2] = list ? pwt->delta_chroma_weight_l1 : pwt->delta_chroma_weight_l0;
+    int(*delta_chroma_offset)[2] = list ? pwt->delta_chroma_offset_l1 : pwt->delta_chroma_offset_l0;
+
+    int n = num_ref_idx_active_minus1 + 1;
+    memset(luma_weight_flag, 0, n * sizeof(*luma_weight_flag));
+    memset(chroma_weight_flag, 0, n * sizeof(*chroma_weight_flag));
+    memset(delta_luma_weight, 0, n * sizeof(*delta_luma_weight));
+    memset(luma_offset, 0, n * sizeof(*luma_offset));
+    memset(delta_chroma_weight, 0, n * sizeof(*delta_chroma_weight));
+    memset(delta_chroma_offset, 0, n * sizeof(*delta_chroma_offset));
+    // the flags are only absent for a reference picture with the poc of the current picture,
+    // which takes pps_curr_pic_ref_enabled_flag (screen content coding) we do not parse
+    for (int i = 0; i < n; i++)
+    {
+        luma_weight_flag[i] = bs_read_u1(b);
+    }
+    if (chroma)
+    {
+        for (int i = 0; i < n; i++)
+        {
+            chroma_weight_flag[i] = bs_read_u1(b);
+        }
+    }
+    for (int i = 0; i < n; i++)
+    {
+        if (luma_weight_flag[i])
+        {
+            delta_luma_weight[i] = bs_read_se(b);
+            luma_offset[i] = bs_read_se(b);
+        }
+        if (chroma_weight_flag[i])
+        {
+            for (int j = 0; j < 2; j++)
+            {
+                delta_chroma_weight[i][j] = bs_read_se(b);
+                delta_chroma_offset[i][j] = bs_read_se(b);
+            }
+        }
+    }
+}
+
+static void h265_read_pred_weight_table(h265_slice_header_t* sh, bs_t* b, int chroma)
+{
+    pred_weight_table_t* pwt = &sh->pred_weight_table;
+    pwt->luma_log2_weight_denom = bs_read_ue(b);
+    pwt->delta_chroma_log2_weight_denom = 0;
+    if (chroma)
+    {
+        pwt->delta_chroma_log2_weight_denom = bs_read_se(b);
+    }
+    h265_read_pred_weight_table_list(pwt, b, sh->num_ref_idx_l0_active_minus1, chroma, 0);
+    if (sh->slice_type == H265_SH_SLICE_TYPE_B)
+    {
+        h265_read_pred_weight_table_list(pwt, b, sh->num_ref_idx_l1_active_minus1, chroma, 1);
+    }
+}
+
+// 7.3.6.2 Reference picture list modification syntax
+static void h265_read_ref_pic_lists_modification(h265_slice_header_t* sh,
+                                                 bs_t* b,
+                                                 int num_pic_total_curr)
+{
+    ref_pic_lists_modification_t* rplm = &sh->ref_pic_lists_modification;
+    int bits = h265_ceil_log2(num_pic_total_curr);
+    rplm->ref_pic_list_modification_flag_l0 = bs_read_u1(b);
+    if (rplm->ref_pic_list_modification_flag_l0)
+    {
+        for (int i = 0; i <= sh->num_ref_idx_l0_active_minus1; i++)
+        {
+            rplm->list_entry_l0[i] = bs_read_u(b, bits);
+        }
+    }
+    rplm->ref_pic_list_modification_flag_l1 = 0;
+    if (sh->slice_type == H265_SH_SLICE_TYPE_B)
+    {
+        rplm->ref_pic_list_modification_flag_l1 = bs_read_u1(b);
+        if (rplm->ref_pic_list_modification_flag_l1)
+        {
+            for (int i = 0; i <= sh->num_ref_idx_l1_active_minus1; i++)
+            {
+                rplm->list_entry_l1[i] = bs_read_u(b, bits);
+            }
+        }
+    }
+}
+
+// 7.3.6.1 General slice segment header syntax
+// The slice's pps and sps become h->pps and h->sps; both are NULL if they were never received.
+// With sh->read_slice_type set parsing stops after slice_pic_order_cnt_lsb. The header of a
+// dependent slice segment keeps the values of the previous independent one.
+static void h265_read_slice_segment_header(h265_stream_t* h, bs_t* b)
+{
+    h265_slice_header_t* sh = h->sh;
+    int nal_unit_type = h->nal->nal_unit_type;
+
+    sh->first_slice_segment_in_pic_flag = bs_read_u1(b);
+    sh->no_output_of_prior_pics_flag = 0;
+    if (nal_unit_type >= NAL_UNIT_CODED_SLICE_BLA_W_LP
+        && nal_unit_type <= NAL_UNIT_RESERVED_IRAP_VCL23)
+    {
+        sh->no_output_of_prior_pics_flag = bs_read_u1(b);
+    }
+    sh->slice_pic_parameter_set_id = bs_read_ue(b);
+    h->pps = sh->slice_pic_parameter_set_id < 64 ? h->pps_table[sh->slice_pic_parameter_set_id]
+                                                 : NULL;
+    h->sps = h->pps && h->pps->pps_seq_parameter_set_id < 16
+                 ? h->sps_table[h->pps->pps_seq_parameter_set_id]
+                 : NULL;
+    if (!h->sps)
+    {
+        h->pps = NULL;
+        return;
+    }
+    h265_pps_t* pps = h->pps;
+    h265_sps_t* sps = h->sps;
+
+    // (7-10) - (7-19)
+    int min_cb_log2_size = sps->log2_min_luma_coding_block_size_minus3 + 3;
+    int ctb_log2_size = min_cb_log2_size + sps->log2_diff_max_min_luma_coding_block_size;
+    int ctb_size = 1 << std::min(std::max(ctb_log2_size, 4), 6);
+    uint32_t pic_width_in_ctbs
+        = ((uint32_t)sps->pic_width_in_luma_samples + ctb_size - 1) / ctb_size;
+    uint32_t pic_height_in_ctbs
+        = ((uint32_t)sps->pic_height_in_luma_samples + ctb_size - 1) / ctb_size;
+    uint32_t pic_size_in_ctbs = pic_width_in_ctbs * pic_height_in_ctbs;
+
+    sh->dependent_slice_segment_flag = 0;
+    sh->slice_segment_address = 0;
+    if (!sh->first_slice_segment_in_pic_flag)
+    {
+        if (pps->dependent_slice_segments_enabled_flag)
+        {
+            sh->dependent_slice_segment_flag = bs_read_u1(b);
+        }
+        sh->slice_segment_address_bytes = h265_ceil_log2(pic_size_in_ctbs);
+        sh->slice_segment_address = bs_read_u(b, sh->slice_segment_address_bytes);
+    }
+    if (sh->dependent_slice_segment_flag)
+    {
+        if (sh->read_slice_type)
+        {
+            return;
+        }
+    }
+    else
+    {
+        for (int i = 0; i < pps->num_extra_slice_header_bits; i++)
+        {
+            sh->slice_reserved_flag[i] = bs_read_u1(b);
+        }
+        sh->slice_type = bs_read_ue(b);
+        sh->pic_output_flag = 1;
+        if (pps->output_flag_present_flag)
+        {
+            sh->pic_output_flag = bs_read_u1(b);
+        }
+        sh->colour_plane_id = 0;
+        if (sps->separate_colour_plane_flag)
+        {
+            sh->colour_plane_id = bs_read_u(b, 2);
+        }
+        int idr = nal_unit_type == NAL_UNIT_CODED_SLICE_IDR_W_RADL
+                  || nal_unit_type == NAL_UNIT_CODED_SLICE_IDR_N_LP;
+        sh->slice_pic_order_cnt_lsb_bytes
+            = std::min(std::max(sps->log2_max_pic_order_cnt_lsb_minus4, 0), 12) + 4;
+        sh->slice_pic_order_cnt_lsb = 0;
+        if (!idr)
+        {
+            sh->slice_pic_order_cnt_lsb = bs_read_u(b, sh->slice_pic_order_cnt_lsb_bytes);
+        }
+        if (sh->read_slice_type)
+        {
+            return;
+        }
+
+        int num_pic_total_curr = 0;  // (7-55)
+        sh->short_term_ref_pic_set_sps_flag = 0;
+        sh->short_term_ref_pic_set_idx = 0;
+        sh->m_pRPS = NULL;
+        sh->num_long_term_sps = 0;
+        sh->num_long_term_pics = 0;
+        sh->slice_temporal_mvp_enabled_flag = 0;
+        if (!idr)
+        {
+            sh->short_term_ref_pic_set_sps_flag = bs_read_u1(b);
+            if (!sh->short_term_ref_pic_set_sps_flag)
+            {
+                h265_read_short_term_ref_pic_set(b,
+                                                 sps,
+                                                 &sh->st_ref_pic_set,
+                                                 &sh->m_localRPS,
+                                                 sps->num_short_term_ref_pic_sets);
+                sh->m_pRPS = &sh->m_localRPS;
+            }
+            else
+            {
+                sh->short_term_ref_pic_set_idx_bytes
+                    = h265_ceil_log2(sps->num_short_term_ref_pic_sets);
+                sh->short_term_ref_pic_set_idx
+                    = bs_read_u(b, sh->short_term_ref_pic_set_idx_bytes);
+                if (sh->short_term_ref_pic_set_idx < sps->num_short_term_ref_pic_sets)
+                {
+                    sh->m_pRPS = &sps->m_RPSList[sh->short_term_ref_pic_set_idx];
+                }
+            }
+            for (int i = 0; sh->m_pRPS && i < sh->m_pRPS->m_numberOfPictures; i++)
+            {
+                num_pic_total_curr += sh->m_pRPS->m_used[i];
+            }
+
+            if (sps->long_term_ref_pics_present_flag)
+            {
+                if (sps->num_long_term_ref_pics_sps > 0)
+                {
+                    sh->num_long_term_sps = bs_read_ue(b);
+                }
+                sh->num_long_term_pics = bs_read_ue(b);
+                int num_long_term = sh->num_long_term_sps + sh->num_long_term_pics;
+                if (num_long_term > MAX_NUM_REF_PICS)
+                {
+                    // corrupt
+                    sh->num_long_term_sps = 0;
+                    sh->num_long_term_pics = 0;
+                    num_long_term = 0;
+                }
+                memset(sh->lt_idx_sps, 0, sizeof(sh->lt_idx_sps));
+                memset(sh->poc_lsb_lt, 0, sizeof(sh->poc_lsb_lt));
+                memset(sh->used_by_curr_pic_lt_flag, 0, sizeof(sh->used_by_curr_pic_lt_flag));
+                memset(sh->delta_poc_msb_present_flag, 0, sizeof(sh->delta_poc_msb_present_flag));
+                memset(sh->delta_poc_msb_cycle_lt, 0, sizeof(sh->delta_poc_msb_cycle_lt));
+                for (int i = 0; i < num_long_term; i++)
+                {
+                    if (i < sh->num_long_term_sps)
+                    {
+                        if (sps->num_long_term_ref_pics_sps > 1)
+                        {
+                            sh->lt_idx_sps[i]
+                                = bs_read_u(b, h265_ceil_log2(sps->num_long_term_ref_pics_sps));
+                        }
+                        if (sh->lt_idx_sps[i] < sps->num_long_term_ref_pics_sps)
+                        {
+                            sh->used_by_curr_pic_lt_flag[i]
+                                = sps->used_by_curr_pic_lt_sps_flag[sh->lt_idx_sps[i]];
+                        }
+                    }
+                    else
+                    {
+                        sh->poc_lsb_lt[i] = bs_read_u(b, sh->slice_pic_order_cnt_lsb_bytes);
+                        sh->used_by_curr_pic_lt_flag[i] = bs_read_u1(b);
+                    }
+                    num_pic_total_curr += sh->used_by_curr_pic_lt_flag[i];
+                    sh->delta_poc_msb_present_flag[i] = bs_read_u1(b);
+                    if (sh->delta_poc_msb_present_flag[i])
+                    {
+                        sh->delta_poc_msb_cycle_lt[i] = bs_read_ue(b);
+                    }
+                }
+            }
+            if (sps->sps_temporal_mvp_enabled_flag)
+            {
+                sh->slice_temporal_mvp_enabled_flag = bs_read_u1(b);
+            }
+        }
+
+        int chroma_array_type = sps->separate_colour_plane_flag ? 0 : sps->chroma_format_idc;
+        sh->slice_sao_luma_flag = 0;
+        sh->slice_sao_chroma_flag = 0;
+        if (sps->sample_adaptive_offset_enabled_flag)
+        {
+            sh->slice_sao_luma_flag = bs_read_u1(b);
+            if (chroma_array_type != 0)
+            {
+                sh->slice_sao_chroma_flag = bs_read_u1(b);
+            }
+        }
+
+        sh->num_ref_idx_active_override_flag = 0;
+        sh->num_ref_idx_l0_active_minus1 = pps->num_ref_idx_l0_default_active_minus1;
+        sh->num_ref_idx_l1_active_minus1 = pps->num_ref_idx_l1_default_active_minus1;
+        sh->ref_pic_lists_modification.ref_pic_list_modification_flag_l0 = 0;
+        sh->ref_pic_lists_modification.ref_pic_list_modification_flag_l1 = 0;
+        sh->mvd_l1_zero_flag = 0;
+        sh->cabac_init_flag = 0;
+        sh->collocated_from_l0_flag = 1;
+        sh->collocated_ref_idx = 0;
+        sh->five_minus_max_num_merge_cand = 0;
+        if (sh->slice_type == H265_SH_SLICE_TYPE_P || sh->slice_type == H265_SH_SLICE_TYPE_B)
+        {
+            sh->num_ref_idx_active_override_flag = bs_read_u1(b);
+            if (sh->num_ref_idx_active_override_flag)
+            {
+                sh->num_ref_idx_l0_active_minus1 = bs_read_ue(b);
+                if (sh->slice_type == H265_SH_SLICE_TYPE_B)
+                {
+                    sh->num_ref_idx_l1_active_minus1 = bs_read_ue(b);
+                }
+            }
+            // list_entry_l0/l1 hold 32 entries, the spec allows 15
+            sh->num_ref_idx_l0_active_minus1 = std::min(sh->num_ref_idx_l0_active_minus1, 31);
+            sh->num_ref_idx_l1_active_minus1 = std::min(sh->num_ref_idx_l1_active_minus1, 31);
+            if (pps->lists_modification_present_flag && num_pic_total_curr > 1)
+            {
+                h265_read_ref_pic_lists_modification(sh, b, num_pic_total_curr);
+            }
+            if (sh->slice_type == H265_SH_SLICE_TYPE_B)
+            {
+                sh->mvd_l1_zero_flag = bs_read_u1(b);
+            }
+            if (pps->cabac_init_present_flag)
+            {
+                sh->cabac_init_flag = bs_read_u1(b);
+            }
+            if (sh->slice_temporal_mvp_enabled_flag)
+            {
+                if (sh->slice_type == H265_SH_SLICE_TYPE_B)
+                {
+                    sh->collocated_from_l0_flag = bs_read_u1(b);
+                }
+                if ((sh->collocated_from_l0_flag && sh->num_ref_idx_l0_active_minus1 > 0)
+                    || (!sh->collocated_from_l0_flag && sh->num_ref_idx_l1_active_minus1 > 0))
+                {
+                    sh->collocated_ref_idx = bs_read_ue(b);
+                }
+            }
+            if ((pps->weighted_pred_flag && sh->slice_type == H265_SH_SLICE_TYPE_P)
+                || (pps->weighted_bipred_flag && sh->slice_type == H265_SH_SLICE_TYPE_B))
+            {
+                h265_read_pred_weight_table(sh, b, chroma_array_type != 0);
+            }
+            sh->five_minus_max_num_merge_cand = bs_read_ue(b);
+        }
+
+        sh->slice_qp_delta = bs_read_se(b);
+        sh->slice_cb_qp_offset = 0;
+        sh->slice_cr_qp_offset = 0;
+        if (pps->pps_slice_chroma_qp_offsets_present_flag)
+        {
+            sh->slice_cb_qp_offset = bs_read_se(b);
+            sh->slice_cr_qp_offset = bs_read_se(b);
+        }
+        sh->cu_chroma_qp_offset_enabled_flag = 0;
+        if (pps->pps_range_extension.chroma_qp_offset_list_enabled_flag)
+        {
+            sh->cu_chroma_qp_offset_enabled_flag = bs_read_u1(b);
+        }
+        sh->deblocking_filter_override_flag = 0;
+        if (pps->deblocking_filter_override_enabled_flag)
+        {
+            sh->deblocking_filter_override_flag = bs_read_u1(b);
+        }
+        sh->slice_deblocking_filter_disabled_flag = pps->pps_deblocking_filter_disabled_flag;
+        sh->slice_beta_offset_div2 = pps->pps_beta_offset_div2;
+        sh->slice_tc_offset_div2 = pps->pps_tc_offset_div2;
+        if (sh->deblocking_filter_override_flag)
+        {
+            sh->slice_deblocking_filter_disabled_flag = bs_read_u1(b);
+            if (!sh->slice_deblocking_filter_disabled_flag)
+            {
+                sh->slice_beta_offset_div2 = bs_read_se(b);
+                sh->slice_tc_offset_div2 = bs_read_se(b);
+            }
+        }
+        sh->slice_loop_filter_across_slices_enabled_flag
+            = pps->pps_loop_filter_across_slices_enabled_flag;
+        if (pps->pps_loop_filter_across_slices_enabled_flag
+            && (sh->slice_sao_luma_flag || sh->slice_sao_chroma_flag
+                || !sh->slice_deblocking_filter_disabled_flag))
+        {
+            sh->slice_loop_filter_across_slices_enabled_flag = bs_read_u1(b);
+        }
+    }
+
+    sh->num_entry_point_offsets = 0;
+    sh->offset_len_minus1 = 0;
+    if (pps->tiles_enabled_flag || pps->entropy_coding_sync_enabled_flag)
+    {
+        sh->num_entry_point_offsets = bs_read_ue(b);
+        if (sh->num_entry_point_offsets > 0)
+        {
+            sh->offset_len_minus1 = bs_read_ue(b);
+            sh->entry_point_offset_minus1_bytes = std::min(sh->offset_len_minus1 + 1, 32);
+            // there is at most one entry point per ctb
+            int n = (int)std::min<uint32_t>(sh->num_entry_point_offsets, pic_size_in_ctbs);
+            int stored = std::min(n, H265_MAX_ENTRY_POINTS);
+            for (int i = 0; i < stored; i++)
+            {
+                sh->entry_point_offset_minus1[i]
+                    = bs_read_u(b, sh->entry_point_offset_minus1_bytes);
+            }
+            for (int i = stored; i < n; i++)
+            {
+                bs_skip_u(b, sh->entry_point_offset_minus1_bytes);
+            }
+        }
+    }
+    sh->slice_segment_header_extension_length = 0;
+    if (pps->slice_segment_header_extension_present_flag)
+    {
+        sh->slice_segment_header_extension_length = bs_read_ue(b);
+        int n = std::min(sh->slice_segment_header_extension_length, 256);
+        for (int i = 0; i < n; i++)
+        {
+            sh->slice_segment_header_extension_data_byte[i] = bs_read_u8(b);
+        }
+    }
+    // byte_alignment()
+    h265_read_rbsp_trailing_bits(b);
+}
+
+// 7.3.2.9 Slice segment layer RBSP syntax
+// slice_segment_data() is neither unescaped nor parsed.
+void h265_read_slice_layer_rbsp(h265_stream_t* h, bs_t* b)
+{
+    h265_read_slice_segment_header(h, b);
+}
+
+static h265_sei_t* h265_next_sei(h265_stream_t* h)
+{
+    if (h->num_seis == h->seis_capacity)
+    {
+        int capacity = h->seis_capacity ? h->seis_capacity * 2 : 4;
+        h->seis = (h265_sei_t**)realloc(h->seis, capacity * sizeof(h265_sei_t*));
+        for (int i = h->seis_capacity; i < capacity; i++)
+        {
+            h->seis[i] = new h265_sei_t();
+        }
+        h->seis_capacity = capacity;
+    }
+    return h->seis[h->num_seis++];
+}
+
+// 7.3.5 Supplemental enhancement information message syntax
+static int h265_read_sei_message(h265_sei_t* sei, bs_t* b)
+{
+    sei->payloadType = 0;
+    int byte = 0xFF;
+    while (byte == 0xFF && !bs_eof(b))
+    {
+        byte = bs_read_u8(b);
+        sei->payloadType += byte;
+    }
+    sei->payloadSize = 0;
+    byte = 0xFF;
+    while (byte == 0xFF && !bs_eof(b))
+    {
+        byte = bs_read_u8(b);
+        sei->payloadSize += byte;
+    }
+    // points into the rbsp buffer instead of a copy
+    sei->payload = b->p;
+    return bs_skip_bytes(b, sei->payloadSize) == sei->payloadSize;
+}
+
+void h265_read_sei_rbsp(h265_stream_t* h, bs_t* b)
+{
+    h->num_seis = 0;
+    h->sei = NULL;
+    do
+    {
+        h265_sei_t* sei = h265_next_sei(h);
+        if (!h265_read_sei_message(sei, b))
+        {
+            h->num_seis--;
+            break;
+        }
+        h->sei = sei;
+    } while (h265_more_rbsp_data(b));
+    h265_read_rbsp_trailing_bits(b);
+}
+
+// 7.2 more_rbsp_data(): anything but rbsp_stop_one_bit and alignment zero bits left
+int h265_more_rbsp_data(bs_t* b)
+{
+    if (bs_eof(b))
+    {
+        return 0;
+    }
+    bs_t tmp;
+    bs_clone(&tmp, b);
+    if (bs_read_u1(&tmp) == 0)
+    {
+        return 1;
+    }
+    while (!bs_eof(&tmp))
+    {
+        if (bs_read_u1(&tmp) == 1)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
 int nal_to_rbsp( int nal_header_size, const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size)
 {
     int i;
@@ -4,8 +4,9 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
-#include <vector>
-using std::vector;
+#include "param_set_cache.hpp"
+#include "rbsp.hpp"
+#include "read_bits.hpp"
 
 #ifdef __cplusplus
 extern "C" {
@@ -17,8 +18,14 @@ typedef struct
     uint8_t* p;
     uint8_t* end;
     int bits_left;
+    // escaped bytes not yet unescaped into [start, end), see bs_init_ebsp
+    const uint8_t* src;
+    const uint8_t* src_end;
 } bs_t;
 
+// escaped bytes unescaped per refill by a bs_init_ebsp reader
+#define BS_EBSP_CHUNK 64
+
 #define _OPTIMIZE_BS_ 1
 
 #if (_OPTIMIZE_BS_ > 0)
@@ -31,6 +38,7 @@ static bs_t* bs_new(uint8_t* buf, size_t size);
 static void bs_free(bs_t* b);
 static bs_t* bs_clone(bs_t* dest, const bs_t* src);
 static bs_t* bs_init(bs_t* b, uint8_t* buf, size_t size);
+static bs_t* bs_init_ebsp(bs_t* b, uint8_t* buf, const uint8_t* ebsp, size_t size);
 static uint32_t bs_byte_aligned(bs_t* b);
 static int bs_eof(bs_t* b);
 static int bs_overrun(bs_t* b);
@@ -63,9 +71,47 @@ static inline bs_t* bs_init(bs_t* b, uint8_t* buf, size_t size)
     b->p = buf;
     b->end = buf + size;
     b->bits_left = 8;
+    b->src = NULL;
+    b->src_end = NULL;
     return b;
 }
 
+// Reads the escaped payload ebsp, removing emulation prevention bytes only as far as the reader
+// gets. buf must hold size bytes; the bytes past the last one read are never unescaped, so
+// parsing a slice header costs the same for a 100 byte and a 1 MB slice.
+static inline bs_t* bs_init_ebsp(bs_t* b, uint8_t* buf, const uint8_t* ebsp, size_t size)
+{
+    bs_init(b, buf, 0);
+    b->src = ebsp;
+    b->src_end = ebsp + size;
+    return b;
+}
+
+static inline void bs_refill(bs_t* b, int nbytes)
+{
+    while (b->src < b->src_end && b->p + nbytes > b->end)
+    {
+        const uint8_t* chunk_end = b->src_end - b->src > BS_EBSP_CHUNK ? b->src + BS_EBSP_CHUNK
+                                                                        : b->src_end;
+        // ending a chunk on a non zero byte keeps every 00 00 03 inside one chunk
+        while (chunk_end < b->src_end && chunk_end[-1] == 0x00)
+        {
+            chunk_end++;
+        }
+        b->end += unescape_rbsp(b->src, chunk_end - b->src, b->end, chunk_end - b->src);
+        b->src = chunk_end;
+    }
+}
+
+// makes nbytes from p on available; a no-op for readers made by bs_init
+static inline void bs_fill(bs_t* b, int nbytes)
+{
+    if (b->src != b->src_end && b->p + nbytes > b->end)
+    {
+        bs_refill(b, nbytes);
+    }
+}
+
 static inline bs_t* bs_new(uint8_t* buf, size_t size)
 {
     bs_t* b = (bs_t*)malloc(sizeof(bs_t));
@@ -81,6 +127,8 @@ static inline bs_t* bs_clone(bs_t* dest, const bs_t* src)
     dest->p = src->p;
     dest->end = src->end;
     dest->bits_left = src->bits_left;
+    dest->src = src->src;
+    dest->src_end = src->src_end;
     return dest;
 }
 
@@ -88,6 +136,7 @@ static inline uint32_t bs_byte_aligned(bs_t* b) { return (b->bits_left == 8); }
 
 static inline int bs_eof(bs_t* b)
 {
+    bs_fill(b, 1);
     if (b->p >= b->end)
     {
         return 1;
@@ -100,6 +149,7 @@ static inline int bs_eof(bs_t* b)
 
 static inline int bs_overrun(bs_t* b)
 {
+    bs_fill(b, 0);
     if (b->p > b->end)
     {
         return 1;
@@ -112,6 +162,7 @@ static inline int bs_overrun(bs_t* b)
 
 static inline int bs_pos(bs_t* b)
 {
+    bs_fill(b, 0);
     if (b->p > b->end)
     {
         return (b->end - b->start);
@@ -122,7 +173,11 @@ static inline int bs_pos(bs_t* b)
     }
 }
 
-static inline int bs_bytes_left(bs_t* b) { return (b->end - b->p); }
+static inline int bs_bytes_left(bs_t* b)
+{
+    bs_fill(b, b->src_end - b->src);
+    return (b->end - b->p);
+}
 
 static inline uint32_t bs_read_u1(bs_t* b)
 {
@@ -166,24 +221,29 @@ static inline uint32_t bs_peek_u1(bs_t* b)
     return r;
 }
 
-static inline uint32_t bs_read_u(bs_t* b, int n)
+static inline uint64_t bs_peek_64(bs_t* b)
 {
-    uint32_t r = 0;
-    int i;
-    for (i = 0; i < n; i++)
-    {
-        r |= (bs_read_u1(b) << (n - i - 1));
-    }
-    return r;
+    bs_fill(b, 8);
+    return peek_bits_64(b->p < b->end ? b->p : b->end, b->end, 8 - b->bits_left);
 }
 
 static inline void bs_skip_u(bs_t* b, int n)
 {
-    int i;
-    for (i = 0; i < n; i++)
+    int bits = 8 - b->bits_left + n;
+    b->p += bits >> 3;
+    b->bits_left = 8 - (bits & 7);
+}
+
+// n <= 32
+static inline uint32_t bs_read_u(bs_t* b, int n)
+{
+    if (n == 0)
     {
-        bs_skip_u1(b);
+        return 0;
     }
+    uint32_t r = (uint32_t)(bs_peek_64(b) >> (64 - n));
+    bs_skip_u(b, n);
+    return r;
 }
 
 static inline uint32_t bs_read_f(bs_t* b, int n) { return bs_read_u(b, n); }
@@ -203,30 +263,32 @@ static inline uint32_t bs_read_u8(bs_t* b)
 
 static inline uint32_t bs_read_ue(bs_t* b)
 {
-    int32_t r = 0;
-    int i = 0;
-
-    while ((bs_read_u1(b) == 0) && (i < 32) && (!bs_eof(b)))
+    uint64_t cache = bs_peek_64(b);
+    int leading_zeros = count_leading_zeros_64(cache);
+    if (leading_zeros > 31)
     {
-        i++;
+        // corrupt or truncated
+        bs_skip_u(b, 32);
+        return 0;
     }
-    r = bs_read_u(b, i);
-    r += (1 << i) - 1;
-    return r;
+    if (leading_zeros <= UE_MAX_CACHED_LEADING_ZEROS)
+    {
+        int bits = 2 * leading_zeros + 1;
+        bs_skip_u(b, bits);
+        return (uint32_t)((cache >> (64 - bits)) - 1);
+    }
+    bs_skip_u(b, leading_zeros + 1);
+    return bs_read_u(b, leading_zeros) + ((1u << leading_zeros) - 1);
 }
 
 static inline int32_t bs_read_se(bs_t* b)
 {
-    int32_t r = bs_read_ue(b);
+    uint32_t r = bs_read_ue(b);
     if (r & 0x01)
     {
-        r = (r + 1) / 2;
+        return (int32_t)((r + 1) / 2);
     }
-    else
-    {
-        r = -(r / 2);
-    }
-    return r;
+    return -(int32_t)(r / 2);
 }
 
 static inline void bs_write_u1(bs_t* b, uint32_t v)
@@ -332,6 +394,7 @@ static inline void bs_write_se(bs_t* b, int32_t v)
 
 static inline int bs_read_bytes(bs_t* b, uint8_t* buf, int len)
 {
+    bs_fill(b, len);
     int actual_len = len;
     if (b->end - b->p < actual_len)
     {
@@ -372,6 +435,7 @@ static inline int bs_write_bytes(bs_t* b, uint8_t* buf, int len)
 
 static inline int bs_skip_bytes(bs_t* b, int len)
 {
+    bs_fill(b, len);
     int actual_len = len;
     if (b->end - b->p < actual_len)
     {
@@ -405,6 +469,7 @@ static inline uint64_t bs_next_bytes(bs_t* bs, int nbytes)
     {
         return 0;
     }
+    bs_fill(bs, nbytes);
     if (bs->p + nbytes > bs->end)
     {
         return 0;
@@ -483,41 +548,41 @@ typedef struct
     uint8_t general_inbld_flag;
     uint8_t general_reserved_zero_bit;
     uint8_t general_level_idc;
-    vector<uint8_t> sub_layer_profile_present_flag;
-    vector<uint8_t> sub_layer_level_present_flag;
+    uint8_t sub_layer_profile_present_flag[8];
+    uint8_t sub_layer_level_present_flag[8];
     uint8_t reserved_zero_2bits[8];
-    vector<uint8_t> sub_layer_profile_space;
-    vector<uint8_t> sub_layer_tier_flag;
-    vector<uint8_t> sub_layer_profile_idc;
-    vector<vector<uint8_t>> sub_layer_profile_compatibility_flag;
-    vector<uint8_t> sub_layer_progressive_source_flag;
-    vector<uint8_t> sub_layer_interlaced_source_flag;
-    vector<uint8_t> sub_layer_non_packed_constraint_flag;
-    vector<uint8_t> sub_layer_frame_only_constraint_flag;
-    vector<uint8_t> sub_layer_max_12bit_constraint_flag;
-    vector<uint8_t> sub_layer_max_10bit_constraint_flag;
-    vector<uint8_t> sub_layer_max_8bit_constraint_flag;
-    vector<uint8_t> sub_layer_max_422chroma_constraint_flag;
-    vector<uint8_t> sub_layer_max_420chroma_constraint_flag;
-    vector<uint8_t> sub_layer_max_monochrome_constraint_flag;
-    vector<uint8_t> sub_layer_intra_constraint_flag;
-    vector<uint8_t> sub_layer_one_picture_only_constraint_flag;
-    vector<uint8_t> sub_layer_lower_bit_rate_constraint_flag;
-    vector<uint64_t> sub_layer_reserved_zero_34bits;
-    vector<uint64_t> sub_layer_reserved_zero_43bits;
-    vector<uint8_t> sub_layer_inbld_flag;
-    vector<uint8_t> sub_layer_reserved_zero_bit;
-    vector<uint8_t> sub_layer_level_idc;
+    uint8_t sub_layer_profile_space[8];
+    uint8_t sub_layer_tier_flag[8];
+    uint8_t sub_layer_profile_idc[8];
+    uint8_t sub_layer_profile_compatibility_flag[8][32];
+    uint8_t sub_layer_progressive_source_flag[8];
+    uint8_t sub_layer_interlaced_source_flag[8];
+    uint8_t sub_layer_non_packed_constraint_flag[8];
+    uint8_t sub_layer_frame_only_constraint_flag[8];
+    uint8_t sub_layer_max_12bit_constraint_flag[8];
+    uint8_t sub_layer_max_10bit_constraint_flag[8];
+    uint8_t sub_layer_max_8bit_constraint_flag[8];
+    uint8_t sub_layer_max_422chroma_constraint_flag[8];
+    uint8_t sub_layer_max_420chroma_constraint_flag[8];
+    uint8_t sub_layer_max_monochrome_constraint_flag[8];
+    uint8_t sub_layer_intra_constraint_flag[8];
+    uint8_t sub_layer_one_picture_only_constraint_flag[8];
+    uint8_t sub_layer_lower_bit_rate_constraint_flag[8];
+    uint64_t sub_layer_reserved_zero_34bits[8];
+    uint64_t sub_layer_reserved_zero_43bits[8];
+    uint8_t sub_layer_inbld_flag[8];
+    uint8_t sub_layer_reserved_zero_bit[8];
+    uint8_t sub_layer_level_idc[8];
 
 } profile_tier_level_t;
 
 typedef struct
 {
-    vector<int> bit_rate_value_minus1;
-    vector<int> cpb_size_value_minus1;
-    vector<int> cpb_size_du_value_minus1;
-    vector<int> bit_rate_du_value_minus1;
-    vector<uint8_t> cbr_flag;
+    int bit_rate_value_minus1[32];  // cpb_cnt_minus1 is at most 31
+    int cpb_size_value_minus1[32];
+    int cpb_size_du_value_minus1[32];
+    int bit_rate_du_value_minus1[32];
+    uint8_t cbr_flag[32];
 } sub_layer_hrd_parameters_t;
 
 /**
@@ -538,11 +603,11 @@ typedef struct
     uint8_t initial_cpb_removal_delay_length_minus1;
     uint8_t au_cpb_removal_delay_length_minus1;
     uint8_t dpb_output_delay_length_minus1;
-    vector<uint8_t> fixed_pic_rate_general_flag;
-    vector<uint8_t> fixed_pic_rate_within_cvs_flag;
-    vector<int> elemental_duration_in_tc_minus1;
-    vector<uint8_t> low_delay_hrd_flag;
-    vector<int> cpb_cnt_minus1;
+    uint8_t fixed_pic_rate_general_flag[8];
+    uint8_t fixed_pic_rate_within_cvs_flag[8];
+    int elemental_duration_in_tc_minus1[8];
+    uint8_t low_delay_hrd_flag[8];
+    int cpb_cnt_minus1[8];
     sub_layer_hrd_parameters_t sub_layer_hrd_parameters;    // nal
     sub_layer_hrd_parameters_t sub_layer_hrd_parameters_v;  // vlc
 } hrd_parameters_t;
@@ -583,8 +648,8 @@ typedef struct
     uint8_t chroma_qp_offset_list_enabled_flag;
     int diff_cu_chroma_qp_offset_depth;
     int chroma_qp_offset_list_len_minus1;
-    vector<int> cb_qp_offset_list;
-    vector<int> cr_qp_offset_list;
+    int cb_qp_offset_list[6];
+    int cr_qp_offset_list[6];
     int log2_sao_offset_scale_luma;
     int log2_sao_offset_scale_chroma;
 } pps_range_extension_t;
@@ -656,46 +721,38 @@ typedef struct
 {
     int luma_log2_weight_denom;
     int delta_chroma_log2_weight_denom;
-    vector<uint8_t> luma_weight_l0_flag;
-    vector<uint8_t> chroma_weight_l0_flag;
-    vector<int> delta_luma_weight_l0;
-    vector<int> luma_offset_l0;
-    vector<vector<int>> delta_chroma_weight_l0;
-    vector<vector<int>> delta_chroma_offset_l0;
-    vector<uint8_t> luma_weight_l1_flag;
-    vector<uint8_t> chroma_weight_l1_flag;
-    vector<int> delta_luma_weight_l1;
-    vector<int> luma_offset_l1;
-    vector<vector<int>> delta_chroma_weight_l1;
-    vector<vector<int>> delta_chroma_offset_l1;
+    uint8_t luma_weight_l0_flag[32];  // as many as list_entry_l0/l1
+    uint8_t chroma_weight_l0_flag[32];
+    int delta_luma_weight_l0[32];
+    int luma_offset_l0[32];
+    int delta_chroma_weight_l0[32][2];
+    int delta_chroma_offset_l0[32][2];
+    uint8_t luma_weight_l1_flag[32];
+    uint8_t chroma_weight_l1_flag[32];
+    int delta_luma_weight_l1[32];
+    int luma_offset_l1[32];
+    int delta_chroma_weight_l1[32][2];
+    int delta_chroma_offset_l1[32][2];
 } pred_weight_table_t;
 
+#define MAX_NUM_REF_PICS 16  ///< max. number of pictures used for reference
+
 typedef struct
 {
     uint8_t inter_ref_pic_set_prediction_flag;
     int delta_idx_minus1;
     uint8_t delta_rps_sign;
     int abs_delta_rps_minus1;
-    vector<uint8_t> used_by_curr_pic_flag;
-    vector<uint8_t> use_delta_flag;
+    uint8_t used_by_curr_pic_flag[MAX_NUM_REF_PICS + 1];
+    uint8_t use_delta_flag[MAX_NUM_REF_PICS + 1];
     int num_negative_pics;
     int num_positive_pics;
-
-#if 1
-    vector<int> delta_poc_s0_minus1;
-    vector<uint8_t> used_by_curr_pic_s0_flag;
-    vector<int> delta_poc_s1_minus1;
-    vector<uint8_t> used_by_curr_pic_s1_flag;
-#else
-    int delta_poc_s0_minus1[16];
-    uint8_t used_by_curr_pic_s0_flag[16];
-    int delta_poc_s1_minus1[16];
-    uint8_t used_by_curr_pic_s1_flag[16];
-#endif
+    int delta_poc_s0_minus1[MAX_NUM_REF_PICS];
+    uint8_t used_by_curr_pic_s0_flag[MAX_NUM_REF_PICS];
+    int delta_poc_s1_minus1[MAX_NUM_REF_PICS];
+    uint8_t used_by_curr_pic_s1_flag[MAX_NUM_REF_PICS];
 } st_ref_pic_set_t;
 
-#define MAX_NUM_REF_PICS 16  ///< max. number of pictures used for reference
-
 typedef struct
 {
     int m_numberOfPictures;
@@ -745,15 +802,15 @@ typedef struct
     int vps_max_latency_increase_plus1[8];
     uint8_t vps_max_layer_id;
     int vps_num_layer_sets_minus1;
-    vector<vector<uint8_t>> layer_id_included_flag;
+    uint8_t layer_id_included_flag[1024][64];
     uint8_t vps_timing_info_present_flag;
     int vps_num_units_in_tick;
     int vps_time_scale;
     uint8_t vps_poc_proportional_to_timing_flag;
     int vps_num_ticks_poc_diff_one_minus1;
     int vps_num_hrd_parameters;
-    vector<int> hrd_layer_set_idx;
-    vector<uint8_t> cprms_present_flag;
+    int hrd_layer_set_idx[1024];
+    uint8_t cprms_present_flag[1024];
     hrd_parameters_t hrd_parameters;
     uint8_t vps_extension_flag;
     uint8_t vps_extension_data_flag;
@@ -806,13 +863,13 @@ typedef struct
     int log2_diff_max_min_pcm_luma_coding_block_size;
     uint8_t pcm_loop_filter_disabled_flag;
     int num_short_term_ref_pic_sets;
-    vector<st_ref_pic_set_t> st_ref_pic_set;
-    vector<referencePictureSets_t> m_RPSList;  // store
+    st_ref_pic_set_t st_ref_pic_set[64];
+    referencePictureSets_t m_RPSList[64];  // store
     uint8_t long_term_ref_pics_present_flag;
     int num_long_term_ref_pics_sps;
     int lt_ref_pic_poc_lsb_sps_bytes;
-    vector<int> lt_ref_pic_poc_lsb_sps;
-    vector<uint8_t> used_by_curr_pic_lt_sps_flag;
+    int lt_ref_pic_poc_lsb_sps[32];
+    uint8_t used_by_curr_pic_lt_sps_flag[32];
     uint8_t sps_temporal_mvp_enabled_flag;
     uint8_t strong_intra_smoothing_enabled_flag;
     uint8_t vui_parameters_present_flag;
@@ -863,8 +920,8 @@ typedef struct
     int num_tile_columns_minus1;
     int num_tile_rows_minus1;
     int uniform_spacing_flag;
-    vector<int> column_width_minus1;
-    vector<int> row_height_minus1;
+    int column_width_minus1[20];
+    int row_height_minus1[22];
     uint8_t loop_filter_across_tiles_enabled_flag;
     uint8_t pps_loop_filter_across_slices_enabled_flag;
     uint8_t deblocking_filter_control_present_flag;
@@ -889,13 +946,17 @@ typedef struct
     // rbsp_trailing_bits( ) ...
 } h265_pps_t;
 
+// With tiles and wavefronts a slice has an entry point per tile column and CTB row: 20 columns
+// and 1056 rows of 16x16 CTBs at level 6.2.
+#define H265_MAX_ENTRY_POINTS (20 * 1056)
+
 /**
   Slice Header
   @see 7.3.6.1  General slice segment header syntax
 */
 typedef struct
 {
-    int read_slice_type;  // see if we only read slice type and return
+    int read_slice_type;  // stop after slice_type and slice_pic_order_cnt_lsb
 
     int first_slice_segment_in_pic_flag;
     uint8_t no_output_of_prior_pics_flag;
@@ -903,7 +964,7 @@ typedef struct
     uint8_t dependent_slice_segment_flag;
     int slice_segment_address;
     int slice_segment_address_bytes;
-    vector<uint8_t> slice_reserved_flag;
+    uint8_t slice_reserved_flag[8];
     int slice_type;
     uint8_t pic_output_flag;
     int colour_plane_id;
@@ -917,11 +978,11 @@ typedef struct
     int short_term_ref_pic_set_idx_bytes;
     int num_long_term_sps;
     int num_long_term_pics;
-    vector<int> lt_idx_sps;
-    vector<int> poc_lsb_lt;
-    vector<uint8_t> used_by_curr_pic_lt_flag;
-    vector<uint8_t> delta_poc_msb_present_flag;
-    vector<int> delta_poc_msb_cycle_lt;
+    int lt_idx_sps[MAX_NUM_REF_PICS];
+    int poc_lsb_lt[MAX_NUM_REF_PICS];
+    uint8_t used_by_curr_pic_lt_flag[MAX_NUM_REF_PICS];
+    uint8_t delta_poc_msb_present_flag[MAX_NUM_REF_PICS];
+    int delta_poc_msb_cycle_lt[MAX_NUM_REF_PICS];
     uint8_t slice_temporal_mvp_enabled_flag;
     uint8_t slice_sao_luma_flag;
     uint8_t slice_sao_chroma_flag;
@@ -947,9 +1008,9 @@ typedef struct
     int num_entry_point_offsets;
     int offset_len_minus1;
     int entry_point_offset_minus1_bytes;
-    vector<int> entry_point_offset_minus1;
+    int entry_point_offset_minus1[H265_MAX_ENTRY_POINTS];
     int slice_segment_header_extension_length;
-    vector<int> slice_segment_header_extension_data_byte;
+    int slice_segment_header_extension_data_byte[256];
     // byte_alignment( )...
 } h265_slice_header_t;
 
@@ -982,12 +1043,31 @@ typedef struct
     h265_sps_t* sps_table[32];
     h265_pps_t* pps_table[256];
     h265_sei_t** seis;
+    int seis_capacity;
     // videoinfo_t* info;
+
+    // unescaped payload of the current NAL, reused for every NAL
+    uint8_t* rbsp_buf;
+    int rbsp_buf_size;
+
+    // escaped payloads the table entries were parsed from
+    param_set_key_t vps_keys[16];
+    param_set_key_t sps_keys[16];
+    param_set_key_t pps_keys[64];
+    param_set_cache_stats_t param_set_cache;
 } h265_stream_t;
 
+// Parameter sets are kept in the vps/sps/pps tables by id. A table entry is allocated the first
+// time its id shows up and is parsed over in place when the id is sent again with different
+// content; a parameter set repeated byte for byte is only hashed and compared, which
+// h->param_set_cache counts as a hit.
 h265_stream_t* h265_new();
 void h265_free(h265_stream_t* h);
 
+// Parses one NAL unit (header included, no start code). h->nal and, depending on the type,
+// h->vps, h->sps, h->pps, h->aud, h->seis or the slice header h->sh are updated. SEI payload
+// pointers stay valid until the next call. Returns size, or -1 if the NAL is broken or a slice
+// refers to a parameter set that has not been received.
 int h265_read_nal_unit(h265_stream_t* h, uint8_t* buf, int size);
 
 void h265_read_vps_rbsp(h265_stream_t* h, bs_t* b);
@@ -1000,6 +1080,7 @@ void h265_read_end_of_seq_rbsp(h265_stream_t* h, bs_t* b);
 void h265_read_end_of_stream_rbsp(h265_stream_t* h, bs_t* b);
 void h265_read_rbsp_trailing_bits(bs_t* b);
 int h265_more_rbsp_trailing_data(bs_t* b);
+int h265_more_rbsp_data(bs_t* b);
 
 int nal_to_rbsp(const int nal_header_size, const uint8_t* nal_buf, int* nal_size, uint8_t* rbsp_buf, int* rbsp_size);
 // Table 7-1 NAL unit type codes and NAL unit type classes
@@ -0,0 +1,127 @@
+#include "keyframe_scan.hpp"
+#include "access_unit.hpp"
+#include "write_all.hpp"
+
+bool keyframe_scan(NalReader* reader, Codec codec, std::vector<KeyframeRecord>* records)
+{
+    records->clear();
+    if (!reader->mapped())
+    {
+        return false;
+    }
+    const uint8_t* base = reader->map_data();
+    // the keyframe further slices are added to, -1 once anything else came in between
+    long current = -1;
+    NalView nal;
+    while (reader->next(&nal))
+    {
+        if (nal.size == 0)
+        {
+            continue;
+        }
+        NalClass c = classify_nal(codec, nal);
+        uint64_t begin = nal.data - base - nal.start_code_len;
+        uint64_t end = nal.data - base + nal.size;
+        if (c.keyframe)
+        {
+            if (current >= 0 && !c.first_slice)
+            {
+                KeyframeRecord& r = (*records)[current];
+                r.size = end - r.offset;
+                r.nals++;
+                continue;
+            }
+            current = (long)records->size();
+        }
+        else if (c.param_set || c.vcl || c.aud)
+        {
+            // other VCL NAL units end a keyframe, SEI and the like between its slices do not
+            current = -1;
+        }
+        if (c.keyframe || c.param_set)
+        {
+            KeyframeRecord r = {begin, end - begin, 1, (uint8_t)c.nal_unit_type, c.keyframe};
+            records->push_back(r);
+        }
+    }
+    return true;
+}
+
+static uint8_t kStartCode[4] = {0x00, 0x00, 0x00, 0x01};
+
+KeyframeExtractor::KeyframeExtractor(Codec codec, const SegmentCallback& open_segment)
+    : codec_(codec)
+    , open_segment_(open_segment)
+    , param_sets_(codec)
+    , in_keyframe_(false)
+    , fd_(-1)
+    , keyframes_(0)
+    , skipped_(0)
+    , bytes_(0)
+{
+}
+
+// the parameter sets and then the NAL units, each behind a 4 byte start code
+bool KeyframeExtractor::write(const std::vector<uint8_t>* const* sets, int set_count,
+                              const NalView& nal)
+{
+    struct iovec iov[8];
+    int count = 0;
+    for (int i = 0; i < set_count; i++)
+    {
+        iov[count++] = {kStartCode, 4};
+        iov[count++] = {const_cast<uint8_t*>(sets[i]->data()), sets[i]->size()};
+    }
+    iov[count++] = {kStartCode, 4};
+    iov[count++] = {const_cast<uint8_t*>(nal.data), nal.size};
+    for (int i = 0; i < count; i++)
+    {
+        bytes_ += iov[i].iov_len;
+    }
+    return writev_all(fd_, iov, count);
+}
+
+// the first slice of a keyframe, the parameter sets it refers to go in front of it
+bool KeyframeExtractor::begin_segment(const NalView& nal)
+{
+    const std::vector<uint8_t>* sets[3];
+    int set_count = param_sets_.active_sets(nal, sets);
+    if (set_count == 0)
+    {
+        skipped_++;
+        return true;
+    }
+    fd_ = open_segment_(keyframes_++);
+    return fd_ < 0 || write(sets, set_count, nal);
+}
+
+bool KeyframeExtractor::push(const NalView& nal)
+{
+    if (nal.size == 0)
+    {
+        return true;
+    }
+    NalClass c = classify_nal(codec_, nal);
+    if (c.keyframe)
+    {
+        if (in_keyframe_ && !c.first_slice)
+        {
+            return fd_ < 0 || write(NULL, 0, nal);
+        }
+        in_keyframe_ = true;
+        fd_ = -1;
+        return begin_segment(nal);
+    }
+    if (c.param_set)
+    {
+        param_sets_.push(nal);
+    }
+    if (c.param_set || c.vcl || c.aud)
+    {
+        in_keyframe_ = false;
+        fd_ = -1;
+        return true;
+    }
+    // SEI and the like between the slices of a keyframe stay with it
+    return !in_keyframe_ || fd_ < 0 || write(NULL, 0, nal);
+}
@@ -0,0 +1,67 @@
+#ifndef __KEYFRAME_SCAN_HPP__
+#define __KEYFRAME_SCAN_HPP__
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "nal_reader.hpp"
+#include "noncopyable.hpp"
+#include "param_set_store.hpp"
+
+// A keyframe or a parameter set of a scanned file.
+struct KeyframeRecord
+{
+    uint64_t offset;        // of the start code (or length) in front of the first NAL unit
+    uint64_t size;          // from offset to the end of the last NAL unit
+    uint32_t nals;          // the slices of a keyframe, 1 for a parameter set
+    uint8_t nal_unit_type;  // of the parameter set or the first slice
+    bool keyframe;
+};
+
+// Finds the IDR pictures (H.264 type 5) or IRAP pictures (H.265 types 16 to 23) and the parameter
+// sets, for thumbnails and GOP audits. Only the NAL header and the byte behind it, which tells the
+// first slice of a picture apart, are read; nothing is parsed or unescaped, and the payloads are
+// passed over by the start code scan, or skipped entirely with length prefixed input. reader must
+// be mapped and past its first start code. records are in file order.
+bool keyframe_scan(NalReader* reader, Codec codec, std::vector<KeyframeRecord>* records);
+
+// Writes every keyframe as a standalone Annex B segment a decoder can start on: the VPS, SPS and
+// PPS its first slice refers to, then its slices and whatever NAL units lie between them, each
+// behind a 4 byte start code. The payloads go to writev straight from the views, which only have
+// to live during the push() they come with, so any NalReader mode will do.
+class KeyframeExtractor
+{
+public:
+    // Called at the first slice of every keyframe with its number, returns the descriptor its
+    // segment is written to, or -1 to leave the keyframe out.
+    typedef std::function<int(uint64_t index)> SegmentCallback;
+
+    KeyframeExtractor(Codec codec, const SegmentCallback& open_segment);
+
+    // every NAL unit of the stream in order, false once a write failed
+    bool push(const NalView& nal);
+
+    // keyframes handed to the callback
+    uint64_t keyframes() const { return keyframes_; }
+    // keyframes left out because their parameter sets were not seen before them
+    uint64_t skipped() const { return skipped_; }
+    uint64_t bytes() const { return bytes_; }
+
+    NONCOPYABLE(KeyframeExtractor);
+
+private:
+    bool begin_segment(const NalView& nal);
+    bool write(const std::vector<uint8_t>* const* sets, int set_count, const NalView& nal);
+
+private:
+    Codec codec_;
+    SegmentCallback open_segment_;
+    ParamSetStore param_sets_;
+    bool in_keyframe_;
+    int fd_;  // of the segment being written, -1 outside of one
+    uint64_t keyframes_;
+    uint64_t skipped_;
+    uint64_t bytes_;
+};
+
+#endif  // __KEYFRAME_SCAN_HPP__
@@ -0,0 +1,180 @@
+#include "length_prefixed.hpp"
+#include <algorithm>
+#include "rbsp.hpp"
+#include "write_all.hpp"
+
+static void put_u16(std::vector<uint8_t>* out, size_t v)
+{
+    out->push_back((v >> 8) & 0xff);
+    out->push_back(v & 0xff);
+}
+
+// the payloads with a 16 bit length in front, as both records list their parameter sets
+static void put_param_sets(std::vector<uint8_t>* out, const std::vector<std::vector<uint8_t>>& sets,
+                           size_t max_count)
+{
+    size_t count = 0;
+    for (const auto& set : sets)
+    {
+        if (!set.empty() && count++ < max_count)
+        {
+            put_u16(out, set.size());
+            out->insert(out->end(), set.begin(), set.end());
+        }
+    }
+}
+
+static size_t count_param_sets(const std::vector<std::vector<uint8_t>>& sets)
+{
+    size_t count = 0;
+    for (const auto& set : sets)
+    {
+        count += !set.empty();
+    }
+    return count;
+}
+
+static int first_param_set(const std::vector<std::vector<uint8_t>>& sets)
+{
+    for (size_t i = 0; i < sets.size(); i++)
+    {
+        if (!sets[i].empty())
+        {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+LengthPrefixedWriter::LengthPrefixedWriter(Codec codec, int fd)
+    : codec_(codec)
+    , fd_(fd)
+    , batched_(0)
+    , nals_(0)
+    , bytes_(0)
+    , param_sets_(codec)
+{
+}
+
+bool LengthPrefixedWriter::write(const NalView& nal)
+{
+    if (nal.size == 0)
+    {
+        return true;
+    }
+    param_sets_.push(nal);
+    uint8_t* length = lengths_ + batched_ * 4;
+    length[0] = (nal.size >> 24) & 0xff;
+    length[1] = (nal.size >> 16) & 0xff;
+    length[2] = (nal.size >> 8) & 0xff;
+    length[3] = nal.size & 0xff;
+    iov_[batched_ * 2].iov_base = length;
+    iov_[batched_ * 2].iov_len = 4;
+    iov_[batched_ * 2 + 1].iov_base = const_cast<uint8_t*>(nal.data);
+    iov_[batched_ * 2 + 1].iov_len = nal.size;
+    batched_++;
+    nals_++;
+    bytes_ += 4 + nal.size;
+    return batched_ < LENGTH_PREFIXED_BATCH || flush();
+}
+
+bool LengthPrefixedWriter::flush()
+{
+    bool ok = writev_all(fd_, iov_, batched_ * 2);
+    batched_ = 0;
+    return ok;
+}
+
+bool LengthPrefixedWriter::avcc_record(std::vector<uint8_t>* record) const
+{
+    const std::vector<std::vector<uint8_t>>& sps_sets = param_sets_.sps();
+    const std::vector<std::vector<uint8_t>>& pps_sets = param_sets_.pps();
+    int first = first_param_set(sps_sets);
+    if (first < 0 || sps_sets[first].size() < 4)
+    {
+        return false;
+    }
+    const std::vector<uint8_t>& sps = sps_sets[first];
+    record->clear();
+    record->push_back(1);         // configurationVersion
+    record->push_back(sps[1]);    // AVCProfileIndication
+    record->push_back(sps[2]);    // profile_compatibility
+    record->push_back(sps[3]);    // AVCLevelIndication
+    record->push_back(0xfc | 3);  // lengthSizeMinusOne
+    size_t sps_count = std::min<size_t>(count_param_sets(sps_sets), 31);
+    record->push_back(0xe0 | sps_count);
+    put_param_sets(record, sps_sets, sps_count);
+    size_t pps_count = std::min<size_t>(count_param_sets(pps_sets), 255);
+    record->push_back(pps_count);
+    put_param_sets(record, pps_sets, pps_count);
+    const h264_sps_t* s = param_sets_.h264()->sps_table[first];
+    int profile_idc = sps[1];
+    if (s && (profile_idc == 100 || profile_idc == 110 || profile_idc == 122 || profile_idc == 144))
+    {
+        record->push_back(0xfc | (s->chroma_format_idc & 3));
+        record->push_back(0xf8 | (s->bit_depth_luma_minus8 & 7));
+        record->push_back(0xf8 | (s->bit_depth_chroma_minus8 & 7));
+        record->push_back(0);  // numOfSequenceParameterSetExt
+    }
+    return true;
+}
+
+bool LengthPrefixedWriter::hvcc_record(std::vector<uint8_t>* record) const
+{
+    const h265_stream_t* h = param_sets_.h265();
+    int first = first_param_set(param_sets_.sps());
+    if (first < 0 || !h->sps_table[first])
+    {
+        return false;
+    }
+    // sps_video_parameter_set_id .. sps_temporal_id_nesting_flag and the 12 bytes of the general
+    // profile_tier_level(), which the record repeats bit for bit
+    const std::vector<uint8_t>& sps = param_sets_.sps()[first];
+    uint8_t ptl[13];
+    if (sps.size() < 2 || unescape_rbsp(sps.data() + 2, sps.size() - 2, ptl, 13) < 13)
+    {
+        return false;
+    }
+    const h265_sps_t* s = h->sps_table[first];
+    int min_spatial_segmentation_idc =
+        s->vui_parameters_present_flag ? s->vui.min_spatial_segmentation_idc & 0xfff : 0;
+    record->clear();
+    record->push_back(1);  // configurationVersion
+    record->insert(record->end(), ptl + 1, ptl + 13);
+    put_u16(record, 0xf000 | min_spatial_segmentation_idc);
+    record->push_back(0xfc);  // parallelismType unknown
+    record->push_back(0xfc | (s->chroma_format_idc & 3));
+    record->push_back(0xf8 | (s->bit_depth_luma_minus8 & 7));
+    record->push_back(0xf8 | (s->bit_depth_chroma_minus8 & 7));
+    put_u16(record, 0);  // avgFrameRate unknown
+    // constantFrameRate 0, numTemporalLayers, temporalIdNested, lengthSizeMinusOne
+    record->push_back(((s->sps_max_sub_layers_minus1 + 1) & 7) << 3
+                      | (s->sps_temporal_id_nesting_flag & 1) << 2 | 3);
+    const std::vector<std::vector<uint8_t>>* arrays[] = {
+        &param_sets_.vps(), &param_sets_.sps(), &param_sets_.pps()};
+    int types[] = {NAL_UNIT_VPS, NAL_UNIT_SPS, NAL_UNIT_PPS};
+    int array_count = 0;
+    for (auto array : arrays)
+    {
+        array_count += count_param_sets(*array) > 0;
+    }
+    record->push_back(array_count);
+    for (int i = 0; i < 3; i++)
+    {
+        size_t count = count_param_sets(*arrays[i]);
+        if (count == 0)
+        {
+            continue;
+        }
+        // array_completeness 0, the parameter sets are in the stream as well
+        record->push_back(types[i]);
+        put_u16(record, count);
+        put_param_sets(record, *arrays[i], count);
+    }
+    return true;
+}
+
+bool LengthPrefixedWriter::configuration_record(std::vector<uint8_t>* record) const
+{
+    return codec_ == CODEC_H264 ? avcc_record(record) : hvcc_record(record);
+}
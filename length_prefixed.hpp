@@ -0,0 +1,53 @@
+#ifndef __LENGTH_PREFIXED_HPP__
+#define __LENGTH_PREFIXED_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <vector>
+#include "nal_reader.hpp"
+#include "noncopyable.hpp"
+#include "param_set_store.hpp"
+
+// NAL units per writev, two iovecs each stay well below IOV_MAX
+#define LENGTH_PREFIXED_BATCH 256
+
+// Writes NAL units with a 4 byte big endian length in front instead of a start code, the sample
+// layout of MP4 (ISO/IEC 14496-15). The payloads go to writev straight from the views, so the
+// views must stay valid until the next flush(), which a mapped NalReader guarantees. Every NAL
+// unit is written, the parameter sets included; they are also kept for the decoder configuration
+// record.
+class LengthPrefixedWriter
+{
+public:
+    LengthPrefixedWriter(Codec codec, int fd);
+
+    bool write(const NalView& nal);
+    bool flush();
+
+    // The avcC (14496-15 5.3.3.1) or hvcC (8.3.3.1) record of the parameter sets written so far,
+    // the latest payload of every id. Returns false before the first SPS.
+    bool configuration_record(std::vector<uint8_t>* record) const;
+
+    uint64_t nals() const { return nals_; }
+    // length prefixes included
+    uint64_t bytes() const { return bytes_; }
+
+    NONCOPYABLE(LengthPrefixedWriter);
+
+private:
+    bool avcc_record(std::vector<uint8_t>* record) const;
+    bool hvcc_record(std::vector<uint8_t>* record) const;
+
+private:
+    Codec codec_;
+    int fd_;
+    struct iovec iov_[LENGTH_PREFIXED_BATCH * 2];
+    uint8_t lengths_[LENGTH_PREFIXED_BATCH * 4];
+    int batched_;
+    uint64_t nals_;
+    uint64_t bytes_;
+    ParamSetStore param_sets_;
+};
+
+#endif  // __LENGTH_PREFIXED_HPP__
@@ -1,63 +1,36 @@
 #include <algorithm>
 #include <assert.h>
-#include <boost/circular_buffer.hpp>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <string>
+#include <thread>
+#include <unistd.h>
 #include <vector>
 #include "scoped_exit.hpp"
+#include "access_unit.hpp"
+#include "batch.hpp"
 #include "h264.hpp"
 #include "read_bits.hpp"
+#include "gop_cut.hpp"
 #include "h265_sps.hpp"
+#include "keyframe_scan.hpp"
+#include "length_prefixed.hpp"
+#include "nal_index.hpp"
+#include "nal_parser.hpp"
+#include "nal_pipeline.hpp"
+#include "nal_reader.hpp"
+#include "parallel_scan.hpp"
+#include "param_set_cache.hpp"
+#include "rbsp.hpp"
 
-using CircularBytes = boost::circular_buffer<uint8_t>;
 using Bytes = std::vector<uint8_t>;
 
-static void pop_3_item(Bytes* buffer)
-{
-    assert(buffer->size() >= 3);
-    buffer->pop_back();
-    buffer->pop_back();
-    buffer->pop_back();
-}
-
-static bool start_code_3_bytes(const CircularBytes& buf)
-{
-    if (buf.size() < 3)
-    {
-        return false;
-    }
-    return (buf[0] == 0x0 && buf[1] == 0x0 && buf[2] == 0x01);
-}
-
-static bool start_code_4_bytes(const CircularBytes& buf, uint8_t ch)
-{
-    if (buf.size() < 3)
-    {
-        return false;
-    }
-    return (buf[0] == 0x0 && buf[1] == 0x0 && buf[2] == 0x0 && ch == 0x01);
-}
-static bool ebsp_code(const CircularBytes& buf, uint8_t ch)
-{
-    if (buf.size() < 3)
-    {
-        return false;
-    }
-    bool prefix = false;
-    bool prevent = false;
-    if (buf[0] == 0x0 && buf[1] == 0x0 && buf[2] == 0x03)
-    {
-        prefix = true;
-    }
-    if (ch == 0x00 || ch == 0x01 || ch == 0x02 || ch == 0x03)
-    {
-        prevent = true;
-    }
-    return prefix && prevent;
-}
-
 struct NaluHeader
 {
     int forbidden_bit;
@@ -95,7 +68,11 @@ void log_nalu_header(const NaluHeader& h)
 
 void rbsp_to_sodb(const Bytes& rbsp, Bytes* sodb)
 {
-    size_t last_byte_pos = rbsp.size();
+    if (rbsp.empty())
+    {
+        return;
+    }
+    size_t last_byte_pos = rbsp.size() - 1;
     int bit_offset = 0;
     while (true)
     {
@@ -106,7 +83,7 @@ void rbsp_to_sodb(const Bytes& rbsp, Bytes* sodb)
         bit_offset++;
         if (bit_offset == 8)
         {
-            if (last_byte_pos == 1)
+            if (last_byte_pos == 0)
             {
                 printf("failed zero data\n");
                 return;
@@ -120,220 +97,904 @@ void rbsp_to_sodb(const Bytes& rbsp, Bytes* sodb)
 
 void ebsp_to_rbsp(const Bytes& ebsp, Bytes* rbsp)
 {
-    CircularBytes bytes(3);
-    for (const auto& ch : ebsp)
+    rbsp->resize(ebsp.size());
+    rbsp->resize(unescape_rbsp(ebsp.data(), ebsp.size(), rbsp->data(), rbsp->size()));
+}
+
+void show_bytes(const Bytes& bytes, const std::string& msg)
+{
+    printf("---------------------%s---------------------\n", msg.data());
+    for (const auto& byte : bytes)
+    {
+        printf("%x ", byte);
+    }
+    printf("\n");
+}
+
+void process_nal_payload(h264_stream_t* h, const NalView& nal)
+{
+    if (nal.size == 0)
     {
-        if (ebsp_code(bytes, ch))
+        return;
+    }
+    uint64_t hits = h->param_set_cache.hits;
+    if (h264_read_nal_unit(h, nal.data, nal.size) < 0)
+    {
+        return;
+    }
+    NaluHeader header;
+    parse_264_nalu_header(&header, nal.data[0]);
+    log_nalu_header(header);
+    if (header.nal_unit_type == H264_NAL_UNIT_TYPE_CODED_SLICE_NON_IDR
+        || header.nal_unit_type == H264_NAL_UNIT_TYPE_CODED_SLICE_IDR)
+    {
+        const h264_slice_header_t* sh = &h->sh;
+        printf("slice first_mb %d slice_type %d frame_num %d poc_lsb %d idr_pic_id %d\n",
+               sh->first_mb_in_slice,
+               sh->slice_type,
+               sh->frame_num,
+               sh->pic_order_cnt_lsb,
+               sh->idr_pic_id);
+        return;
+    }
+    if (header.nal_unit_type != 7 && header.nal_unit_type != 8)
+    {
+        return;
+    }
+    // a repeated parameter set has been dumped already
+    if (hits != h->param_set_cache.hits)
+    {
+        if (header.nal_unit_type == 7)
         {
-            bytes.clear();
-            rbsp->pop_back();
+            printf("h264 stream %ldx%ld\n", h->sps->width, h->sps->height);
         }
-        bytes.push_back(ch);
-        rbsp->push_back(ch);
+        return;
+    }
+    std::string name("sps ");
+    if (header.nal_unit_type == 8)
+    {
+        name = "pps ";
+    }
+    Bytes ebsp(nal.data + 1, nal.data + nal.size);
+    Bytes rbsp;
+    Bytes sodb;
+    ebsp_to_rbsp(ebsp, &rbsp);
+    if (rbsp.empty())
+    {
+        return;
+    }
+    rbsp_to_sodb(rbsp, &sodb);
+    if (sodb.empty())
+    {
+        return;
+    }
+    show_bytes(ebsp, name + "ebsp");
+    show_bytes(rbsp, name + "rbsp");
+    show_bytes(sodb, name + "sodb");
+    if (header.nal_unit_type == 7)
+    {
+        const h264_sps_t* sps = h->sps;
+        printf("h264 stream %ldx%ld\n", sps->width, sps->height);
+        printf("sps %d profile %d level %d fps %.2f max_num_reorder_frames %d\n",
+               sps->seq_parameter_set_id,
+               sps->profile_idc,
+               sps->level_idc,
+               sps->framerate,
+               sps->vui.max_num_reorder_frames);
+    }
+    else
+    {
+        printf("pps %d sps %d entropy_coding_mode_flag %d\n",
+               h->pps->pic_parameter_set_id,
+               h->pps->seq_parameter_set_id,
+               h->pps->entropy_coding_mode_flag);
     }
 }
 
-bool find_first_start_code(FILE* fp)
+void process_h265_nal_payload(h265_stream_t* h, const NalView& view)
 {
-    CircularBytes bytes(3);
-    while (true)
+    if (h265_read_nal_unit(h, const_cast<uint8_t*>(view.data), view.size) < 0)
     {
-        if (start_code_3_bytes(bytes))
-        {
+        return;
+    }
+    switch (h->nal->nal_unit_type)
+    {
+        case NAL_UNIT_VPS:
+            printf("vps %d max_sub_layers_minus1 %d\n",
+                   h->vps->vps_video_parameter_set_id,
+                   h->vps->vps_max_sub_layers_minus1);
             break;
-        }
-        else
-        {
-            if (feof(fp))
+        case NAL_UNIT_SPS:
+            printf("%ldx%ld\n", h->sps->width, h->sps->height);
+            break;
+        case NAL_UNIT_PPS:
+            printf("pps %d sps %d\n",
+                   h->pps->pps_pic_parameter_set_id,
+                   h->pps->pps_seq_parameter_set_id);
+            break;
+        case NAL_UNIT_AUD:
+            printf("aud pic_type %d\n", h->aud->pic_type);
+            break;
+        case NAL_UNIT_PREFIX_SEI:
+        case NAL_UNIT_SUFFIX_SEI:
+            for (int i = 0; i < h->num_seis; i++)
             {
-                return false;
+                printf("sei payload type %d size %d\n",
+                       h->seis[i]->payloadType,
+                       h->seis[i]->payloadSize);
             }
-            uint8_t ch = getc(fp);
-            if (start_code_4_bytes(bytes, ch))
+            break;
+        default:
+            if (h->nal->parsed == h->sh)
             {
-                break;
+                printf("slice nal type %d slice_type %d first_slice_segment_in_pic_flag %d "
+                       "poc_lsb %d\n",
+                       h->nal->nal_unit_type,
+                       h->sh->slice_type,
+                       h->sh->first_slice_segment_in_pic_flag,
+                       h->sh->slice_pic_order_cnt_lsb);
             }
-            bytes.push_back(ch);
-        }
+            break;
     }
-    return true;
 }
 
-void show_bytes(const Bytes& bytes, const std::string& msg)
+void print_access_unit(const AccessUnit& au, int index)
 {
-    printf("---------------------%s---------------------\n", msg.data());
-    for (const auto& byte : bytes)
+    printf("access unit %d nals %zu bytes %zu keyframe %d\n",
+           index, au.nals.size(), au.size, au.keyframe);
+}
+
+void print_block_reads(const NalReader& reader)
+{
+    if (reader.block_reads())
     {
-        printf("%x ", byte);
+        printf("block reads %s\n", reader.uring() ? "io_uring" : "pread");
     }
-    printf("\n");
 }
 
-void process_nal_payload(const Bytes& buff)
+void parse_h265_file(const std::string& filename, ReadMode mode, int length_size)
 {
-    if (buff.empty())
+    NalReader reader;
+    reader.set_length_size(length_size);
+    if (!reader.open(filename, mode))
     {
         return;
     }
-    NaluHeader h;
-    parse_264_nalu_header(&h, buff[0]);
-    log_nalu_header(h);
-    if (h.nal_unit_type != 7 && h.nal_unit_type != 8)
+    if (reader.find_first_start_code() == false)
     {
+        printf("invalid h264 stream : not found first start code\n");
         return;
     }
-    std::string s("sps ");
-    if (h.nal_unit_type == 8)
+    h265_stream_t* h = h265_new();
+    auto stream_free = make_scoped_exit([&h]() { h265_free(h); });
+    // the ref pic sets and everything after them are not printed
+    h->sh->read_slice_type = 1;
+    AccessUnitAssembler assembler(CODEC_H265);
+    AccessUnit au;
+    int au_count = 0;
+    NalView nal;
+    while (reader.next(&nal))
     {
-        s = "pps ";
+        if (assembler.push(nal, &au))
+        {
+            print_access_unit(au, au_count++);
+        }
+        process_h265_nal_payload(h, nal);
     }
-    Bytes ebsp = buff;
-    Bytes rbsp;
-    Bytes sodb;
-    ebsp.erase(ebsp.begin());
-    ebsp_to_rbsp(ebsp, &rbsp);
-    if (rbsp.empty())
+    if (assembler.flush(&au))
+    {
+        print_access_unit(au, au_count++);
+    }
+    printf("parameter set cache hits %lu misses %lu\n",
+           (unsigned long)h->param_set_cache.hits,
+           (unsigned long)h->param_set_cache.misses);
+    print_block_reads(reader);
+    printf("file eof\n");
+}
+void parse_h264_file(const std::string& filename, ReadMode mode, int length_size)
+{
+    NalReader reader;
+    reader.set_length_size(length_size);
+    if (!reader.open(filename, mode))
     {
         return;
     }
-    rbsp_to_sodb(rbsp, &sodb);
-    if (sodb.empty())
+    if (reader.find_first_start_code() == false)
     {
+        printf("invalid h264 stream : not found first start code\n");
         return;
     }
-    show_bytes(ebsp, s + "ebsp");
-    show_bytes(rbsp, s + "rbsp");
-    show_bytes(sodb, s + "sodb");
-    if (h.nal_unit_type == 7)
+    h264_stream_t* h = h264_new();
+    auto stream_free = make_scoped_exit([&h]() { h264_free(h); });
+    AccessUnitAssembler assembler(CODEC_H264);
+    AccessUnit au;
+    int au_count = 0;
+    NalView nal;
+    while (reader.next(&nal))
+    {
+        if (assembler.push(nal, &au))
+        {
+            print_access_unit(au, au_count++);
+        }
+        process_nal_payload(h, nal);
+    }
+    if (assembler.flush(&au))
     {
-        int64_t width = 0;
-        int64_t height = 0;
-        h264_width_height(ebsp.data(), ebsp.size(), &width, &height);
-        printf("h264 stream %ldx%ld\n", width, height);
+        print_access_unit(au, au_count++);
     }
+    printf("parameter set cache hits %lu misses %lu\n",
+           (unsigned long)h->param_set_cache.hits,
+           (unsigned long)h->param_set_cache.misses);
+    print_block_reads(reader);
+    printf("file eof\n");
 }
 
-void find_nal_payload(FILE* fp, Bytes* buffer)
+void print_queue_stats(const char* name, const SpscQueueStats& s)
 {
-    CircularBytes bytes(3);
-    buffer->clear();
-    while (feof(fp) == false)
-    {
-        if (start_code_3_bytes(bytes))
+    printf("queue %s pushed %lu mean depth %.1f max depth %lu full stalls %lu empty stalls %lu\n",
+           name,
+           (unsigned long)s.pushed,
+           s.pushed ? (double)s.depth_sum / s.pushed : 0.0,
+           (unsigned long)s.max_depth,
+           (unsigned long)s.full_stalls,
+           (unsigned long)s.empty_stalls);
+}
+
+// reading, start code scanning and parsing on their own threads
+void parse_file_pipelined(const std::string& filename, Codec codec)
+{
+    h264_stream_t* h264 = h264_new();
+    h265_stream_t* h265 = h265_new();
+    auto stream_free = make_scoped_exit([&h264, &h265]() {
+        h264_free(h264);
+        h265_free(h265);
+    });
+    h265->sh->read_slice_type = 1;
+    NalPipeline pipeline;
+    bool opened = pipeline.run(filename, [&](const NalView& nal) {
+        if (codec == CODEC_H264)
         {
-            pop_3_item(buffer);
-            break;
+            process_nal_payload(h264, nal);
         }
         else
         {
-            uint8_t ch = getc(fp);
-            if (start_code_4_bytes(bytes, ch))
-            {
-                pop_3_item(buffer);
-                break;
-            }
-            bytes.push_back(ch);
-            buffer->push_back(ch);
+            process_h265_nal_payload(h265, nal);
         }
+    });
+    if (!opened)
+    {
+        printf("%s can not be opened\n", filename.c_str());
+        return;
     }
+    const param_set_cache_stats_t& cache =
+        codec == CODEC_H264 ? h264->param_set_cache : h265->param_set_cache;
+    printf("parameter set cache hits %lu misses %lu\n",
+           (unsigned long)cache.hits,
+           (unsigned long)cache.misses);
+    PipelineStats stats = pipeline.stats();
+    printf("pipeline bytes %lu ring full stalls %lu\n",
+           (unsigned long)stats.bytes,
+           (unsigned long)stats.ring_full_stalls);
+    print_queue_stats("blocks", stats.blocks);
+    print_queue_stats("nals", stats.nals);
+    printf("file eof\n");
 }
 
-void process_h265_nal_payload(const Bytes& buff)
+// the input read() in small pieces and pushed into a NalParser, as a live source would arrive
+void parse_file_streamed(const std::string& filename, Codec codec)
 {
-    if (buff.size() < 2)
+    int fd = filename == "-" ? STDIN_FILENO : open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
     {
+        printf("%s can not be opened\n", filename.c_str());
         return;
     }
-    Bytes ebsp = buff;
-    h265_nal_t nal;
-    memset(&nal, 0, sizeof nal);
+    auto file_close = make_scoped_exit([&fd]() {
+        if (fd != STDIN_FILENO)
+        {
+            close(fd);
+        }
+    });
+    h264_stream_t* h264 = h264_new();
+    h265_stream_t* h265 = h265_new();
+    auto stream_free = make_scoped_exit([&h264, &h265]() {
+        h264_free(h264);
+        h265_free(h265);
+    });
+    h265->sh->read_slice_type = 1;
+    NalParser parser(codec);
+    int au_count = 0;
+    parser.set_access_unit_callback(
+        [&au_count](const AccessUnit& au) { print_access_unit(au, au_count++); });
+    parser.set_nal_callback([&](const NalView& nal) {
+        if (codec == CODEC_H264)
+        {
+            process_nal_payload(h264, nal);
+        }
+        else
+        {
+            process_h265_nal_payload(h265, nal);
+        }
+    });
+    uint8_t buf[64 << 10];
+    uint64_t bytes = 0;
+    while (true)
+    {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        parser.push(buf, n);
+        bytes += n;
+    }
+    parser.flush();
+    const param_set_cache_stats_t& cache =
+        codec == CODEC_H264 ? h264->param_set_cache : h265->param_set_cache;
+    printf("parameter set cache hits %lu misses %lu\n",
+           (unsigned long)cache.hits,
+           (unsigned long)cache.misses);
+    printf("stream bytes %lu nals %lu\n", (unsigned long)bytes, (unsigned long)parser.nals());
+    printf("file eof\n");
+}
 
-    bs_t* b = bs_new(ebsp.data(), ebsp.size());
-    // nal header
-    nal.forbidden_zero_bit = bs_read_f(b, 1);
-    nal.nal_unit_type = bs_read_u(b, 6);
-    nal.nuh_layer_id = bs_read_u(b, 6);
-    nal.nuh_temporal_id_plus1 = bs_read_u(b, 3);
-    nal.parsed = NULL;
-    nal.sizeof_parsed = 0;
-    bs_free(b);
+// Rewrites the input with 4 byte lengths instead of start codes into output, and the avcC or hvcC
+// record into output.avcC / output.hvcC.
+void convert_to_length_prefixed(const std::string& filename, const std::string& output,
+                                Codec codec)
+{
+    NalReader reader;
+    if (!reader.open(filename) || !reader.find_first_start_code())
+    {
+        printf("invalid stream : not found first start code\n");
+        return;
+    }
+    int fd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        printf("%s can not be created\n", output.c_str());
+        return;
+    }
+    auto file_close = make_scoped_exit([&fd]() { close(fd); });
+    LengthPrefixedWriter writer(codec, fd);
+    NalView nal;
+    bool ok = true;
+    while (ok && reader.next(&nal))
+    {
+        // buffered views only live until the next call
+        ok = writer.write(nal) && (reader.mapped() || writer.flush());
+    }
+    if (!ok || !writer.flush())
+    {
+        printf("%s can not be written\n", output.c_str());
+        return;
+    }
+    Bytes record;
+    if (!writer.configuration_record(&record))
+    {
+        printf("no sequence parameter set, no configuration record\n");
+    }
+    else
+    {
+        std::string name = output + (codec == CODEC_H264 ? ".avcC" : ".hvcC");
+        FILE* fp = fopen(name.c_str(), "wb");
+        if (!fp || fwrite(record.data(), 1, record.size(), fp) != record.size())
+        {
+            printf("%s can not be written\n", name.c_str());
+        }
+        if (fp)
+        {
+            fclose(fp);
+        }
+    }
+    printf("length prefixed nals %lu bytes %lu record %zu bytes\n",
+           (unsigned long)writer.nals(),
+           (unsigned long)writer.bytes(),
+           record.size());
+}
 
-    int nal_size = ebsp.size();
-    int rbsp_size = ebsp.size();
-    uint8_t* rbsp_buf = (uint8_t*)malloc(rbsp_size);
+// the keyframes and parameter sets, found from the NAL headers alone
+void scan_keyframes(const std::string& filename, Codec codec, int length_size)
+{
+    NalReader reader;
+    reader.set_length_size(length_size);
+    if (!reader.open(filename) || !reader.mapped())
+    {
+        printf("%s can not be mapped\n", filename.c_str());
+        return;
+    }
+    std::vector<KeyframeRecord> records;
+    if (!reader.find_first_start_code() || !keyframe_scan(&reader, codec, &records))
+    {
+        printf("invalid stream : not found first start code\n");
+        return;
+    }
+    size_t keyframes = 0;
+    for (const auto& r : records)
+    {
+        printf("%s offset %lu size %lu nals %u type %d\n",
+               r.keyframe ? "keyframe" : "parameter set",
+               (unsigned long)r.offset,
+               (unsigned long)r.size,
+               r.nals,
+               r.nal_unit_type);
+        keyframes += r.keyframe;
+    }
+    printf("keyframes %zu parameter sets %zu\n", keyframes, records.size() - keyframes);
+    printf("file eof\n");
+}
 
-    int rc = nal_to_rbsp(2, buff.data(), &nal_size, rbsp_buf, &rbsp_size);
+// Every keyframe with its parameter sets as a standalone stream, to prefix-<n>.h264/.h265, or all
+// of them one after the other to stdout for prefix "-".
+void extract_keyframes(const std::string& filename, const std::string& prefix, Codec codec,
+                       ReadMode mode, int length_size)
+{
+    NalReader reader;
+    reader.set_length_size(length_size);
+    if (!reader.open(filename, mode) || !reader.find_first_start_code())
+    {
+        printf("invalid stream : not found first start code\n");
+        return;
+    }
+    bool to_stdout = prefix == "-";
+    // the summary must not end up among the segments
+    FILE* log = to_stdout ? stderr : stdout;
+    int fd = -1;
+    auto file_close = make_scoped_exit([&fd, to_stdout]() {
+        if (fd >= 0 && !to_stdout)
+        {
+            close(fd);
+        }
+    });
+    KeyframeExtractor extractor(codec, [&](uint64_t index) {
+        if (to_stdout)
+        {
+            return (int)STDOUT_FILENO;
+        }
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "-%06lu.%s", (unsigned long)index,
+                 codec == CODEC_H264 ? "h264" : "h265");
+        fd = open((prefix + name).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            fprintf(log, "%s%s can not be created\n", prefix.c_str(), name);
+        }
+        return fd;
+    });
+    NalView nal;
+    while (reader.next(&nal))
+    {
+        if (!extractor.push(nal))
+        {
+            fprintf(log, "keyframe %lu can not be written\n",
+                    (unsigned long)extractor.keyframes() - 1);
+            return;
+        }
+    }
+    fprintf(log, "keyframes %lu skipped %lu bytes %lu\n",
+            (unsigned long)extractor.keyframes(),
+            (unsigned long)extractor.skipped(),
+            (unsigned long)extractor.bytes());
+}
 
-    if (rc < 0)
+// Access units [begin, end), or the ones of seconds [begin, end), from the keyframe in front of
+// begin on, to output ("-" for stdout).
+void cut_file(const std::string& filename, Codec codec, int length_size, double begin, double end,
+              bool seconds, const std::string& output)
+{
+    bool to_stdout = output == "-";
+    FILE* log = to_stdout ? stderr : stdout;
+    NalIndex index;
+    if (!index.open_or_build(filename, codec, length_size))
+    {
+        fprintf(log, "%s can not be indexed\n", filename.c_str());
+        return;
+    }
+    if (seconds)
+    {
+        double frame_rate = index.header().frame_rate;
+        if (frame_rate <= 0)
+        {
+            fprintf(log, "%s has no frame rate\n", filename.c_str());
+            return;
+        }
+        begin *= frame_rate;
+        end *= frame_rate;
+    }
+    // a fractional end still takes the access unit it falls into
+    uint64_t first = (uint64_t)std::max(begin, 0.0);
+    uint64_t last = end < 0 ? UINT64_MAX : (uint64_t)ceil(std::min(end, 1e18));
+    int fd = to_stdout ? STDOUT_FILENO : open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
     {
-        free(rbsp_buf);
+        fprintf(log, "%s can not be created\n", output.c_str());
         return;
-    }  // handle conversion error
-    if (nal.nal_unit_type != 33)
+    }
+    auto file_close = make_scoped_exit([&fd, to_stdout]() {
+        if (!to_stdout)
+        {
+            close(fd);
+        }
+    });
+    CutResult cut;
+    if (!cut_stream(index, filename, first, last, fd, &cut))
     {
+        fprintf(log, "access units %lu until %lu can not be cut\n",
+                (unsigned long)first,
+                (unsigned long)last);
         return;
     }
-    b = bs_new(rbsp_buf, rbsp_size);
-    h265_sps_t sps;
-    h265_read_sps_rbsp(&sps, b);
-    printf("%ldx%ld\n", sps.width, sps.height);
+    fprintf(log, "cut access units %lu count %lu offset %lu bytes %lu injected %lu\n",
+            (unsigned long)cut.first_access_unit,
+            (unsigned long)cut.access_units,
+            (unsigned long)cut.offset,
+            (unsigned long)cut.size,
+            (unsigned long)cut.injected);
+}
 
+enum IndexQuery
+{
+    INDEX_LIST,  // every keyframe
+    INDEX_KEYFRAME,
+    INDEX_OFFSET,
+    INDEX_TIME,
+};
+
+void print_index_keyframe(const NalIndex& index, const NalIndexAccessUnit* au)
+{
+    printf("keyframe access unit %lu offset %lu size %lu nals %u time %.3f\n",
+           (unsigned long)(au - index.access_units()),
+           (unsigned long)au->offset,
+           (unsigned long)au->size,
+           au->nal_count,
+           index.time_of(au));
 }
-void parse_h265_file(const std::string& filename)
+
+// answers query from the sidecar index of filename, built first if it is missing or stale
+void query_index(const std::string& filename, Codec codec, int length_size, IndexQuery query,
+                 double value)
 {
-    FILE* fp = fopen(filename.data(), "rb");
-    if (!fp)
+    NalIndex index;
+    if (!index.open_or_build(filename, codec, length_size))
     {
+        printf("%s can not be indexed\n", filename.c_str());
         return;
     }
-    auto file_close = make_scoped_exit([&fp]() { fclose(fp); });
-
-    if (find_first_start_code(fp) == false)
+    const NalIndexHeader& h = index.header();
+    printf("index %s nals %lu access units %lu keyframes %lu frame rate %.2f\n",
+           index.built() ? "built" : "loaded",
+           (unsigned long)h.nal_count,
+           (unsigned long)h.access_unit_count,
+           (unsigned long)h.keyframe_count,
+           h.frame_rate);
+    const NalIndexAccessUnit* au = NULL;
+    switch (query)
     {
-        printf("invalid h264 stream : not found first start code\n");
+        case INDEX_LIST:
+            for (uint64_t k = 0; k < h.keyframe_count; k++)
+            {
+                print_index_keyframe(index, index.keyframe(k));
+            }
+            return;
+        case INDEX_KEYFRAME:
+            au = index.keyframe((uint64_t)value);
+            break;
+        case INDEX_OFFSET:
+            au = index.keyframe_at_offset((uint64_t)value);
+            break;
+        case INDEX_TIME:
+            au = index.keyframe_at_time(value);
+            break;
+    }
+    if (!au)
+    {
+        printf("no keyframe\n");
         return;
     }
-    Bytes buffer;
-    while (feof(fp) == false)
+    print_index_keyframe(index, au);
+}
+
+// Keeps the sidecar index of a stream that is still being written up to date, until the stream
+// is removed. Polling the size costs next to nothing, an update only scans the appended bytes.
+void follow_index(const std::string& filename, Codec codec, int length_size)
+{
+    off_t size = -1;
+    uint64_t access_units = 0;
+    struct stat st;
+    while (stat(filename.c_str(), &st) == 0)
     {
-        find_nal_payload(fp, &buffer);
-        process_h265_nal_payload(buffer);
-        buffer.clear();
+        if (st.st_size != size)
+        {
+            size = st.st_size;
+            NalIndex index;
+            if (NalIndex::update(filename, codec, length_size)
+                && index.open(filename, codec, length_size)
+                && index.header().access_unit_count != access_units)
+            {
+                const NalIndexHeader& h = index.header();
+                access_units = h.access_unit_count;
+                printf("index bytes %lu nals %lu access units %lu keyframes %lu\n",
+                       (unsigned long)h.source_size,
+                       (unsigned long)h.nal_count,
+                       (unsigned long)h.access_unit_count,
+                       (unsigned long)h.keyframe_count);
+                fflush(stdout);
+            }
+        }
+        usleep(200 * 1000);
     }
-    printf("file eof\n");
+    printf("%s is gone\n", filename.c_str());
 }
-void parse_h264_file(const std::string& filename)
+
+// the records of parallel_scan, in file order
+void scan_file_parallel(const std::string& filename, Codec codec, int threads)
 {
-    FILE* fp = fopen(filename.data(), "rb");
-    if (!fp)
+    NalReader reader;
+    if (!reader.open(filename) || !reader.mapped())
     {
+        printf("%s can not be mapped\n", filename.c_str());
         return;
     }
-    auto file_close = make_scoped_exit([&fp]() { fclose(fp); });
-
-    if (find_first_start_code(fp) == false)
+    std::vector<NalRecord> nals;
+    if (!parallel_scan(reader.map_data(), reader.map_size(), codec, threads, &nals))
     {
-        printf("invalid h264 stream : not found first start code\n");
+        printf("invalid stream : not found first start code\n");
         return;
     }
-    Bytes buffer;
-    while (feof(fp) == false)
+    size_t pictures = 0;
+    size_t broken = 0;
+    for (const auto& r : nals)
     {
-        find_nal_payload(fp, &buffer);
-        process_nal_payload(buffer);
-        buffer.clear();
+        printf("nal offset %lu size %u type %d slice_type %d first_slice %d\n",
+               (unsigned long)r.offset,
+               r.size,
+               r.nal_unit_type,
+               r.slice_type,
+               (r.flags & NAL_RECORD_FIRST_SLICE) != 0);
+        pictures += (r.flags & NAL_RECORD_FIRST_SLICE) != 0;
+        broken += (r.flags & NAL_RECORD_BROKEN) != 0;
     }
+    printf("nal units %zu pictures %zu broken %zu\n", nals.size(), pictures, broken);
     printf("file eof\n");
 }
 
+// every stream listed in path, one parser state per stream on a pool of threads
+void analyze_batch(const std::string& path, Codec codec, int threads)
+{
+    std::vector<std::string> filenames;
+    if (!list_batch_inputs(path, &filenames))
+    {
+        printf("%s can not be opened\n", path.c_str());
+        return;
+    }
+    if (threads <= 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<StreamSummary> summaries;
+    uint64_t steals = batch_analyze(filenames, codec, threads, &summaries);
+    double seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    uint64_t bytes = 0;
+    for (const auto& s : summaries)
+    {
+        if (!s.opened)
+        {
+            printf("stream %s can not be opened\n", s.filename.c_str());
+            continue;
+        }
+        printf("stream %s %s bytes %lu nals %lu access units %lu keyframes %lu broken %lu "
+               "%.3f s\n",
+               s.filename.c_str(),
+               s.codec == CODEC_H264 ? "h264" : "h265",
+               (unsigned long)s.bytes,
+               (unsigned long)s.nals,
+               (unsigned long)s.access_units,
+               (unsigned long)s.keyframes,
+               (unsigned long)s.broken,
+               s.seconds);
+        bytes += s.bytes;
+    }
+    printf("batch streams %zu bytes %lu threads %d steals %lu %.3f s\n",
+           summaries.size(),
+           (unsigned long)bytes,
+           threads,
+           (unsigned long)steals,
+           seconds);
+}
+
 int main(int argc, char** argv)
 {
-    if (argc < 2)
+    Codec codec = CODEC_H265;
+    int threads = 0;
+    bool pipelined = false;
+    bool streamed = false;
+    ReadMode read_mode = READ_MAP;
+    int length_size = 0;
+    bool indexed = false;
+    bool follow = false;
+    bool keyframes = false;
+    const char* extract = NULL;
+    const char* cut = NULL;
+    bool cut_seconds = false;
+    const char* cut_output = NULL;
+    IndexQuery index_query = INDEX_LIST;
+    double index_value = 0;
+    const char* output = NULL;
+    bool batch = false;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i++)
+    {
+        if (strcmp(argv[i], "-264") == 0)
+        {
+            codec = CODEC_H264;
+        }
+        else if (strcmp(argv[i], "-265") == 0)
+        {
+            codec = CODEC_H265;
+        }
+        else if (strcmp(argv[i], "-p") == 0)
+        {
+            pipelined = true;
+        }
+        else if (strcmp(argv[i], "-o") == 0 && i + 2 < argc)
+        {
+            output = argv[++i];
+        }
+        else if (strcmp(argv[i], "-u") == 0)
+        {
+            read_mode = READ_AHEAD;
+        }
+        else if (strcmp(argv[i], "-l") == 0 && i + 2 < argc)
+        {
+            length_size = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-i") == 0)
+        {
+            indexed = true;
+        }
+        else if (strcmp(argv[i], "-f") == 0)
+        {
+            follow = true;
+        }
+        else if (strcmp(argv[i], "-K") == 0)
+        {
+            keyframes = true;
+        }
+        else if (strcmp(argv[i], "-x") == 0 && i + 2 < argc)
+        {
+            extract = argv[++i];
+        }
+        else if ((strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "-T") == 0) && i + 2 < argc)
+        {
+            cut_seconds = argv[i][1] == 'T';
+            cut = argv[++i];
+        }
+        else if (strcmp(argv[i], "-w") == 0 && i + 2 < argc)
+        {
+            cut_output = argv[++i];
+        }
+        else if ((strcmp(argv[i], "-k") == 0 || strcmp(argv[i], "-O") == 0
+                  || strcmp(argv[i], "-t") == 0)
+                 && i + 2 < argc)
+        {
+            indexed = true;
+            index_query = argv[i][1] == 'k' ? INDEX_KEYFRAME
+                          : argv[i][1] == 'O' ? INDEX_OFFSET
+                                              : INDEX_TIME;
+            index_value = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "-s") == 0)
+        {
+            streamed = true;
+        }
+        else if (strcmp(argv[i], "-b") == 0)
+        {
+            batch = true;
+        }
+        else if (strcmp(argv[i], "-j") == 0 && i + 2 < argc)
+        {
+            threads = atoi(argv[++i]);
+        }
+        else
+        {
+            break;
+        }
+    }
+    // length prefixed input only for the plain sequential parse and the index
+    if (length_size != 0
+        && ((length_size != 1 && length_size != 2 && length_size != 4) || output || batch
+            || threads > 0 || pipelined || streamed))
+    {
+        i = argc;
+    }
+    // begin:end, either may be left out
+    double cut_begin = 0;
+    double cut_end = -1;
+    if (cut)
     {
-        printf("%s input filename\n", argv[0]);
+        const char* colon = strchr(cut, ':');
+        cut_begin = atof(cut);
+        cut_end = colon && colon[1] ? atof(colon + 1) : -1;
+        if (!colon || !cut_output)
+        {
+            i = argc;
+        }
+    }
+    if (i >= argc || (argv[i][0] == '-' && argv[i][1] != '\0'))
+    {
+        printf("%s [-264|-265] [-j threads] [-p|-s|-u] input filename, - for stdin\n", argv[0]);
+        printf("%s [-264|-265] [-j threads] -b list file or directory\n", argv[0]);
+        printf("%s [-264|-265] -o length prefixed output input filename\n", argv[0]);
+        printf("%s [-264|-265] [-u] -l 1|2|4 length prefixed input filename\n", argv[0]);
+        printf("%s [-264|-265] [-l 1|2|4] -i|-k nth keyframe|-O byte offset|-t seconds "
+               "input filename\n",
+               argv[0]);
+        printf("%s [-264|-265] [-l 1|2|4] -f growing input filename\n", argv[0]);
+        printf("%s [-264|-265] [-l 1|2|4] -K keyframes of input filename\n", argv[0]);
+        printf("%s [-264|-265] [-l 1|2|4] [-u] -x keyframe prefix, - for stdout input filename\n",
+               argv[0]);
+        printf("%s [-264|-265] [-l 1|2|4] -c first:end access unit|-T seconds:seconds "
+               "-w output, - for stdout input filename\n",
+               argv[0]);
         exit(0);
     }
-    // parse_h264_file(argv[1]);
-    parse_h265_file(argv[1]);
+    if (cut)
+    {
+        cut_file(argv[i], codec, length_size, cut_begin, cut_end, cut_seconds, cut_output);
+    }
+    else if (extract)
+    {
+        extract_keyframes(argv[i], extract, codec, read_mode, length_size);
+    }
+    else if (keyframes)
+    {
+        scan_keyframes(argv[i], codec, length_size);
+    }
+    else if (follow)
+    {
+        follow_index(argv[i], codec, length_size);
+    }
+    else if (indexed)
+    {
+        query_index(argv[i], codec, length_size, index_query, index_value);
+    }
+    else if (output)
+    {
+        convert_to_length_prefixed(argv[i], output, codec);
+    }
+    else if (batch)
+    {
+        analyze_batch(argv[i], codec, threads);
+    }
+    else if (threads > 0)
+    {
+        scan_file_parallel(argv[i], codec, threads);
+    }
+    else if (pipelined)
+    {
+        parse_file_pipelined(argv[i], codec);
+    }
+    else if (streamed)
+    {
+        parse_file_streamed(argv[i], codec);
+    }
+    else if (codec == CODEC_H264)
+    {
+        parse_h264_file(argv[i], read_mode, length_size);
+    }
+    else
+    {
+        parse_h265_file(argv[i], read_mode, length_size);
+    }
     return 0;
 }
@@ -0,0 +1,528 @@
+#include "nal_index.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <vector>
+#include "access_unit.hpp"
+#include "h264.hpp"
+#include "h265_sps.hpp"
+#include "scoped_exit.hpp"
+
+static int64_t mtime_ns(const struct stat& st)
+{
+    return (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+}
+
+// writes all of data at offset
+static bool pwrite_all(int fd, const void* data, size_t size, uint64_t offset)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, p, size, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool pread_all(int fd, void* data, size_t size, uint64_t offset)
+{
+    uint8_t* p = static_cast<uint8_t*>(data);
+    while (size > 0)
+    {
+        ssize_t n = pread(fd, p, size, offset);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// half as much again, so a growing stream moves its sidecar to a new file only now and then
+static uint64_t capacity_for(uint64_t count) { return std::max<uint64_t>(count + count / 2, 256); }
+
+static uint64_t access_unit_section(const NalIndexHeader& h)
+{
+    return sizeof(NalIndexHeader) + h.nal_capacity * sizeof(NalIndexNal);
+}
+
+static uint64_t keyframe_section(const NalIndexHeader& h)
+{
+    return access_unit_section(h) + h.access_unit_capacity * sizeof(NalIndexAccessUnit);
+}
+
+static uint64_t sidecar_size(const NalIndexHeader& h)
+{
+    return keyframe_section(h) + h.keyframe_capacity * sizeof(uint32_t);
+}
+
+static bool valid_header(const NalIndexHeader& h, Codec codec, int length_size, uint64_t size)
+{
+    // capacities bounded first, so the size computed from them does not wrap
+    return memcmp(h.magic, NAL_INDEX_MAGIC, sizeof(h.magic)) == 0 && h.version == NAL_INDEX_VERSION
+           && h.codec == (uint32_t)codec && h.length_size == (uint32_t)length_size
+           && h.nal_capacity <= size && h.access_unit_capacity <= size
+           && h.keyframe_capacity <= size && h.nal_count <= h.nal_capacity
+           && h.access_unit_count <= h.access_unit_capacity
+           && h.keyframe_count <= h.keyframe_capacity && sidecar_size(h) == size;
+}
+
+// the frame rate of the first SPS with timing info, parameter sets are the only NAL units parsed
+struct FrameRateProbe
+{
+    explicit FrameRateProbe(Codec codec)
+        : codec(codec)
+        , h264(codec == CODEC_H264 ? h264_new() : NULL)
+        , h265(codec == CODEC_H265 ? h265_new() : NULL)
+        , frame_rate(0)
+    {
+    }
+
+    ~FrameRateProbe()
+    {
+        h264_free(h264);
+        h265_free(h265);
+    }
+
+    void push(const NalView& nal, int nal_unit_type)
+    {
+        if (frame_rate > 0)
+        {
+            return;
+        }
+        if (codec == CODEC_H264 && nal_unit_type == H264_NAL_UNIT_TYPE_SPS
+            && h264_read_nal_unit(h264, nal.data, nal.size) >= 0 && h264->sps)
+        {
+            frame_rate = h264->sps->framerate;
+        }
+        // h265_read_nal_unit does not write to buf
+        if (codec == CODEC_H265 && nal_unit_type == NAL_UNIT_SPS
+            && h265_read_nal_unit(h265, const_cast<uint8_t*>(nal.data), nal.size) >= 0
+            && h265->sps)
+        {
+            frame_rate = h265->sps->vui_parameters_present_flag ? h265->sps->framerate : 0;
+        }
+    }
+
+    Codec codec;
+    h264_stream_t* h264;
+    h265_stream_t* h265;
+    double frame_rate;
+
+    NONCOPYABLE(FrameRateProbe);
+};
+
+NalIndex::NalIndex()
+    : map_(NULL)
+    , map_size_(0)
+    , built_(false)
+    , header_(NULL)
+    , nals_(NULL)
+    , access_units_(NULL)
+    , keyframes_(NULL)
+{
+}
+
+NalIndex::~NalIndex() { close(); }
+
+std::string NalIndex::sidecar_filename(const std::string& filename) { return filename + ".nalidx"; }
+
+// What a scan of the stream found, numbered on from the entries already in the sidecar.
+struct IndexEntries
+{
+    std::vector<NalIndexNal> nals;
+    std::vector<NalIndexAccessUnit> access_units;
+    std::vector<uint32_t> keyframes;
+    double frame_rate;
+};
+
+// the NAL units from the position of the mapped reader to the end of the stream
+static void scan_entries(NalReader* reader, Codec codec, uint32_t first_nal,
+                         uint32_t first_access_unit, IndexEntries* e)
+{
+    const uint8_t* base = reader->map_data();
+    FrameRateProbe probe(codec);
+    probe.frame_rate = e->frame_rate;
+    AccessUnitAssembler assembler(codec);
+    AccessUnit au;
+    uint32_t au_first_nal = 0;
+    // closes the access unit of NAL units [au_first_nal, end) of e->nals
+    auto end_access_unit = [&](uint32_t end, bool keyframe) {
+        NalIndexAccessUnit a = {};
+        const NalIndexNal& first = e->nals[au_first_nal];
+        a.offset = first.offset - first.start_code_len;
+        a.first_nal = first_nal + au_first_nal;
+        a.nal_count = end - au_first_nal;
+        a.flags = keyframe ? NAL_INDEX_KEYFRAME : 0;
+        for (uint32_t i = au_first_nal; i < end; i++)
+        {
+            e->nals[i].flags |= a.flags;
+        }
+        e->nals[au_first_nal].flags |= NAL_INDEX_ACCESS_UNIT_START;
+        if (!e->access_units.empty())
+        {
+            e->access_units.back().size = a.offset - e->access_units.back().offset;
+        }
+        if (keyframe)
+        {
+            e->keyframes.push_back(first_access_unit + (uint32_t)e->access_units.size());
+        }
+        e->access_units.push_back(a);
+        au_first_nal = end;
+    };
+    NalView nal;
+    while (reader->next(&nal))
+    {
+        NalIndexNal n = {};
+        n.offset = nal.data - base;
+        n.size = (uint32_t)nal.size;
+        n.start_code_len = (uint8_t)nal.start_code_len;
+        if (nal.size > 0)
+        {
+            n.nal_unit_type = codec == CODEC_H264 ? nal.data[0] & 0x1f : (nal.data[0] >> 1) & 0x3f;
+            // nuh_temporal_id_plus1 - 1, H.264 has no temporal id outside of SVC
+            int temporal_id_plus1 = codec == CODEC_H265 && nal.size > 1 ? nal.data[1] & 0x07 : 0;
+            n.temporal_id = temporal_id_plus1 > 0 ? temporal_id_plus1 - 1 : 0;
+            probe.push(nal, n.nal_unit_type);
+        }
+        uint32_t index = (uint32_t)e->nals.size();
+        if (assembler.push(nal, &au))
+        {
+            end_access_unit(index, au.keyframe);
+        }
+        n.access_unit = first_access_unit + (uint32_t)e->access_units.size();
+        e->nals.push_back(n);
+    }
+    if (assembler.flush(&au))
+    {
+        end_access_unit((uint32_t)e->nals.size(), au.keyframe);
+    }
+    if (!e->access_units.empty())
+    {
+        e->access_units.back().size = reader->map_size() - e->access_units.back().offset;
+    }
+    e->frame_rate = probe.frame_rate;
+}
+
+// a new sidecar with room to grow, written under a temporary name and renamed into place
+static bool write_sidecar(const std::string& name, NalIndexHeader* h, const IndexEntries& e)
+{
+    h->nal_count = e.nals.size();
+    h->access_unit_count = e.access_units.size();
+    h->keyframe_count = e.keyframes.size();
+    h->frame_rate = e.frame_rate;
+    h->nal_capacity = capacity_for(h->nal_count);
+    h->access_unit_capacity = capacity_for(h->access_unit_count);
+    h->keyframe_capacity = capacity_for(h->keyframe_count);
+    std::string temporary = name + "." + std::to_string(getpid());
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+    bool ok = ftruncate(fd, sidecar_size(*h)) == 0
+              && pwrite_all(fd, h, sizeof(*h), 0)
+              && pwrite_all(fd, e.nals.data(), e.nals.size() * sizeof(NalIndexNal),
+                            sizeof(NalIndexHeader))
+              && pwrite_all(fd, e.access_units.data(),
+                            e.access_units.size() * sizeof(NalIndexAccessUnit),
+                            access_unit_section(*h))
+              && pwrite_all(fd, e.keyframes.data(), e.keyframes.size() * sizeof(uint32_t),
+                            keyframe_section(*h));
+    ok = ::close(fd) == 0 && ok;
+    if (!ok || rename(temporary.c_str(), name.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void set_source(NalIndexHeader* h, const struct stat& st)
+{
+    h->source_size = st.st_size;
+    h->source_mtime_ns = mtime_ns(st);
+}
+
+bool NalIndex::build(const std::string& filename, Codec codec, int length_size)
+{
+    struct stat st;
+    NalReader reader;
+    reader.set_length_size(length_size);
+    if (stat(filename.c_str(), &st) != 0 || !reader.open(filename) || !reader.mapped()
+        || !reader.find_first_start_code())
+    {
+        return false;
+    }
+    IndexEntries e;
+    e.frame_rate = 0;
+    scan_entries(&reader, codec, 0, 0, &e);
+    NalIndexHeader h = {};
+    memcpy(h.magic, NAL_INDEX_MAGIC, sizeof(h.magic));
+    h.version = NAL_INDEX_VERSION;
+    h.codec = codec;
+    h.length_size = length_size;
+    set_source(&h, st);
+    return write_sidecar(sidecar_filename(filename), &h, e);
+}
+
+bool NalIndex::update(const std::string& filename, Codec codec, int length_size)
+{
+    std::string name = sidecar_filename(filename);
+    int fd = ::open(name.c_str(), O_RDWR);
+    if (fd < 0)
+    {
+        return build(filename, codec, length_size);
+    }
+    auto file_close = make_scoped_exit([&fd]() { ::close(fd); });
+    struct stat index_st;
+    struct stat st;
+    NalIndexHeader h;
+    if (fstat(fd, &index_st) != 0 || !pread_all(fd, &h, sizeof(h), 0)
+        || !valid_header(h, codec, length_size, index_st.st_size)
+        || stat(filename.c_str(), &st) != 0 || (uint64_t)st.st_size < h.source_size)
+    {
+        return build(filename, codec, length_size);
+    }
+    if ((uint64_t)st.st_size == h.source_size)
+    {
+        // rewritten in place if it was modified without growing
+        return h.source_mtime_ns == mtime_ns(st) || build(filename, codec, length_size);
+    }
+    NalReader reader;
+    reader.set_length_size(length_size);
+    if (!reader.open(filename) || !reader.mapped())
+    {
+        return false;
+    }
+    // the last access unit may have been cut off by the end of the stream, it is scanned again
+    uint32_t first_nal = 0;
+    uint32_t first_access_unit = 0;
+    uint64_t keyframe_count = h.keyframe_count;
+    size_t resume = 0;
+    if (h.access_unit_count > 0)
+    {
+        NalIndexAccessUnit last;
+        NalIndexNal nal;
+        first_access_unit = (uint32_t)h.access_unit_count - 1;
+        if (!pread_all(fd, &last, sizeof(last),
+                       access_unit_section(h) + first_access_unit * sizeof(last))
+            || last.first_nal >= h.nal_count
+            || !pread_all(fd, &nal, sizeof(nal),
+                          sizeof(NalIndexHeader) + last.first_nal * sizeof(nal)))
+        {
+            return build(filename, codec, length_size);
+        }
+        // the stream was appended to if the same NAL unit is still where the access unit began
+        const uint8_t* data = reader.map_data();
+        bool same = nal.size > 0 && nal.offset < reader.map_size()
+                    && nal.offset == last.offset + nal.start_code_len
+                    && (codec == CODEC_H264 ? data[nal.offset] & 0x1f
+                                            : (data[nal.offset] >> 1) & 0x3f)
+                           == nal.nal_unit_type
+                    && (length_size > 0
+                        || (nal.offset >= 3 && data[nal.offset - 3] == 0x00
+                            && data[nal.offset - 2] == 0x00 && data[nal.offset - 1] == 0x01));
+        if (!same)
+        {
+            return build(filename, codec, length_size);
+        }
+        first_nal = last.first_nal;
+        keyframe_count -= (last.flags & NAL_INDEX_KEYFRAME) ? 1 : 0;
+        resume = last.offset;
+    }
+    if (!reader.skip_to(resume) || !reader.find_first_start_code())
+    {
+        return build(filename, codec, length_size);
+    }
+    IndexEntries e;
+    e.frame_rate = h.frame_rate;
+    scan_entries(&reader, codec, first_nal, first_access_unit, &e);
+    uint64_t nal_count = first_nal + e.nals.size();
+    uint64_t access_unit_count = first_access_unit + e.access_units.size();
+    uint64_t new_keyframe_count = keyframe_count + e.keyframes.size();
+    set_source(&h, st);
+    if (nal_count > h.nal_capacity || access_unit_count > h.access_unit_capacity
+        || new_keyframe_count > h.keyframe_capacity)
+    {
+        // out of room, the entries in front of the scan go to the new file as well
+        IndexEntries all;
+        all.nals.resize(nal_count);
+        all.access_units.resize(access_unit_count);
+        all.keyframes.resize(new_keyframe_count);
+        all.frame_rate = e.frame_rate;
+        if (!pread_all(fd, all.nals.data(), first_nal * sizeof(NalIndexNal),
+                       sizeof(NalIndexHeader))
+            || !pread_all(fd, all.access_units.data(),
+                          first_access_unit * sizeof(NalIndexAccessUnit),
+                          access_unit_section(h))
+            || !pread_all(fd, all.keyframes.data(), keyframe_count * sizeof(uint32_t),
+                          keyframe_section(h)))
+        {
+            return build(filename, codec, length_size);
+        }
+        std::copy(e.nals.begin(), e.nals.end(), all.nals.begin() + first_nal);
+        std::copy(e.access_units.begin(), e.access_units.end(),
+                  all.access_units.begin() + first_access_unit);
+        std::copy(e.keyframes.begin(), e.keyframes.end(), all.keyframes.begin() + keyframe_count);
+        return write_sidecar(name, &h, all);
+    }
+    // the entries first and the counts last
+    if (!pwrite_all(fd, e.nals.data(), e.nals.size() * sizeof(NalIndexNal),
+                    sizeof(NalIndexHeader) + first_nal * sizeof(NalIndexNal))
+        || !pwrite_all(fd, e.access_units.data(),
+                       e.access_units.size() * sizeof(NalIndexAccessUnit),
+                       access_unit_section(h) + first_access_unit * sizeof(NalIndexAccessUnit))
+        || !pwrite_all(fd, e.keyframes.data(), e.keyframes.size() * sizeof(uint32_t),
+                       keyframe_section(h) + keyframe_count * sizeof(uint32_t)))
+    {
+        return false;
+    }
+    h.nal_count = nal_count;
+    h.access_unit_count = access_unit_count;
+    h.keyframe_count = new_keyframe_count;
+    h.frame_rate = e.frame_rate;
+    return pwrite_all(fd, &h, sizeof(h), 0);
+}
+
+bool NalIndex::open(const std::string& filename, Codec codec, int length_size)
+{
+    close();
+    struct stat source;
+    if (stat(filename.c_str(), &source) != 0)
+    {
+        return false;
+    }
+    int fd = ::open(sidecar_filename(filename).c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
+    auto file_close = make_scoped_exit([&fd]() { ::close(fd); });
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(NalIndexHeader))
+    {
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+    {
+        return false;
+    }
+    map_ = p;
+    map_size_ = st.st_size;
+    const NalIndexHeader* h = static_cast<const NalIndexHeader*>(map_);
+    if (!valid_header(*h, codec, length_size, map_size_)
+        || h->source_size != (uint64_t)source.st_size || h->source_mtime_ns != mtime_ns(source))
+    {
+        close();
+        return false;
+    }
+    const char* data = static_cast<const char*>(map_);
+    header_ = h;
+    nals_ = reinterpret_cast<const NalIndexNal*>(data + sizeof(NalIndexHeader));
+    access_units_ = reinterpret_cast<const NalIndexAccessUnit*>(data + access_unit_section(*h));
+    keyframes_ = reinterpret_cast<const uint32_t*>(data + keyframe_section(*h));
+    return true;
+}
+
+bool NalIndex::open_or_build(const std::string& filename, Codec codec, int length_size)
+{
+    built_ = false;
+    if (open(filename, codec, length_size))
+    {
+        return true;
+    }
+    built_ = update(filename, codec, length_size);
+    return built_ && open(filename, codec, length_size);
+}
+
+void NalIndex::close()
+{
+    if (map_)
+    {
+        munmap(map_, map_size_);
+    }
+    map_ = NULL;
+    map_size_ = 0;
+    header_ = NULL;
+    nals_ = NULL;
+    access_units_ = NULL;
+    keyframes_ = NULL;
+}
+
+const NalIndexAccessUnit* NalIndex::keyframe(uint64_t n) const
+{
+    if (!header_ || n >= header_->keyframe_count)
+    {
+        return NULL;
+    }
+    return access_units_ + keyframes_[n];
+}
+
+const NalIndexAccessUnit* NalIndex::keyframe_before(uint64_t index) const
+{
+    const uint32_t* end = keyframes_ + header_->keyframe_count;
+    const uint32_t* k = std::upper_bound(keyframes_, end, index);
+    return k == keyframes_ ? NULL : access_units_ + k[-1];
+}
+
+const NalIndexAccessUnit* NalIndex::keyframe_at_offset(uint64_t offset) const
+{
+    if (!header_ || header_->access_unit_count == 0)
+    {
+        return NULL;
+    }
+    const NalIndexAccessUnit* end = access_units_ + header_->access_unit_count;
+    const NalIndexAccessUnit* au = std::upper_bound(
+        access_units_, end, offset, [](uint64_t offset, const NalIndexAccessUnit& a) {
+            return offset < a.offset;
+        });
+    if (au == access_units_)
+    {
+        return NULL;
+    }
+    return keyframe_before(au - access_units_ - 1);
+}
+
+const NalIndexAccessUnit* NalIndex::keyframe_at_time(double seconds) const
+{
+    if (!header_ || header_->frame_rate <= 0 || seconds < 0)
+    {
+        return NULL;
+    }
+    double index = seconds * header_->frame_rate;
+    return keyframe_before((uint64_t)std::min(index, (double)UINT64_MAX / 2));
+}
+
+double NalIndex::time_of(const NalIndexAccessUnit* au) const
+{
+    if (!header_ || header_->frame_rate <= 0)
+    {
+        return 0;
+    }
+    return (au - access_units_) / header_->frame_rate;
+}
@@ -0,0 +1,135 @@
+#ifndef __NAL_INDEX_HPP__
+#define __NAL_INDEX_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "nal_reader.hpp"
+#include "noncopyable.hpp"
+
+#define NAL_INDEX_MAGIC "NALINDEX"
+// bumped whenever the layout of the file changes, older sidecars are then rebuilt
+#define NAL_INDEX_VERSION 2
+
+enum NalIndexFlag
+{
+    NAL_INDEX_ACCESS_UNIT_START = 1,  // the first NAL unit of its access unit
+    NAL_INDEX_KEYFRAME = 2,           // the NAL unit or access unit belongs to a keyframe
+};
+
+// The sidecar is the 96 byte header followed by room for nal_capacity NAL units (24 bytes each),
+// access_unit_capacity access units (32 bytes each) and keyframe_capacity access unit indices of
+// the keyframes (uint32_t), the first *_count of each in use. Everything is in host byte order and
+// naturally aligned, so a mapping of the file is used as it is. The spare room lets an update of a
+// growing stream write the new entries in place, and the counts after them, so a reader mapping
+// the file meanwhile sees a consistent prefix.
+struct NalIndexHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t codec;
+    // the stream the index was built from, a different size or mtime means it is stale
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint32_t length_size;  // 0 for Annex B
+    uint32_t reserved;
+    uint64_t nal_count;
+    uint64_t access_unit_count;
+    uint64_t keyframe_count;
+    double frame_rate;  // of the first SPS, 0 without timing info
+    uint64_t nal_capacity;
+    uint64_t access_unit_capacity;
+    uint64_t keyframe_capacity;
+};
+
+struct NalIndexNal
+{
+    uint64_t offset;  // of the NAL header
+    uint32_t size;    // without trailing zero bytes
+    uint32_t access_unit;
+    uint8_t nal_unit_type;
+    uint8_t temporal_id;
+    uint8_t start_code_len;  // or the length size
+    uint8_t flags;
+    uint32_t reserved;
+};
+
+struct NalIndexAccessUnit
+{
+    uint64_t offset;  // of the start code in front of its first NAL unit
+    uint64_t size;    // up to the next access unit or the end of the stream
+    uint32_t first_nal;
+    uint32_t nal_count;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+// the record sizes are part of the file format
+static_assert(sizeof(NalIndexHeader) == 96, "NalIndexHeader layout");
+static_assert(sizeof(NalIndexNal) == 24, "NalIndexNal layout");
+static_assert(sizeof(NalIndexAccessUnit) == 32, "NalIndexAccessUnit layout");
+
+// The NAL units and access units of a stream, kept in a binary sidecar next to it so the stream
+// is scanned once rather than on every open. Access units are numbered in decoding order, their
+// time is the index over the frame rate of the SPS. A stream that is still being written is
+// indexed as far as it goes; its last access unit may be incomplete and is scanned again by the
+// next update().
+class NalIndex
+{
+public:
+    NalIndex();
+    ~NalIndex();
+
+    // filename with ".nalidx" appended
+    static std::string sidecar_filename(const std::string& filename);
+
+    // Scans the mapped stream filename and writes its sidecar, through a temporary file renamed
+    // into place, so readers never map a half written index.
+    static bool build(const std::string& filename, Codec codec, int length_size = 0);
+
+    // Brings the sidecar of a stream that has grown since up to date. Only the last access unit
+    // the sidecar has and the bytes behind it are scanned, the new entries are written in place
+    // while they fit. Anything that does not look like an append (another codec, a stream that
+    // did not grow, another NAL unit where the last access unit began) builds the sidecar from
+    // scratch. Updates of one stream must not run concurrently.
+    static bool update(const std::string& filename, Codec codec, int length_size = 0);
+
+    // Maps the sidecar of filename. Returns false if there is none, or it is of another version,
+    // codec or length size, or filename changed since it was built.
+    bool open(const std::string& filename, Codec codec, int length_size = 0);
+    // open() and update() if that fails
+    bool open_or_build(const std::string& filename, Codec codec, int length_size = 0);
+    void close();
+    // the last open_or_build() had to build or update the sidecar
+    bool built() const { return built_; }
+
+    const NalIndexHeader& header() const { return *header_; }
+    const NalIndexNal* nals() const { return nals_; }
+    const NalIndexAccessUnit* access_units() const { return access_units_; }
+
+    // the nth keyframe, counted from 0, NULL past the last one
+    const NalIndexAccessUnit* keyframe(uint64_t n) const;
+    // The last keyframe starting at or before offset / seconds, the one to decode from to get
+    // there. NULL if there is none, or for a time without a frame rate.
+    const NalIndexAccessUnit* keyframe_at_offset(uint64_t offset) const;
+    const NalIndexAccessUnit* keyframe_at_time(double seconds) const;
+    // decoding time of an access unit, 0 without a frame rate
+    double time_of(const NalIndexAccessUnit* au) const;
+
+    NONCOPYABLE(NalIndex);
+
+private:
+    // the last keyframe with an access unit index up to index
+    const NalIndexAccessUnit* keyframe_before(uint64_t index) const;
+
+private:
+    void* map_;
+    size_t map_size_;
+    bool built_;
+    const NalIndexHeader* header_;
+    const NalIndexNal* nals_;
+    const NalIndexAccessUnit* access_units_;
+    const uint32_t* keyframes_;
+};
+
+#endif  // __NAL_INDEX_HPP__
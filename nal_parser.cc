@@ -0,0 +1,130 @@
+#include "nal_parser.hpp"
+#include <string.h>
+#include <algorithm>
+#include "start_code.hpp"
+
+NalParser::NalParser(Codec codec)
+    : assembler_(codec)
+    , synced_(false)
+    , start_code_len_(0)
+    , nals_(0)
+{
+}
+
+void NalParser::report_access_unit()
+{
+    // the views the assembler kept point into pushes that are gone
+    for (size_t i = 0; i < access_unit_.nals.size(); i++)
+    {
+        access_unit_.nals[i].data = au_bytes_.data() + au_offsets_[i];
+    }
+    on_access_unit_(access_unit_);
+    au_bytes_.clear();
+    au_offsets_.clear();
+}
+
+void NalParser::emit(const uint8_t* data, size_t size)
+{
+    // trailing_zero_8bits and the leading zero of a 4 byte start code
+    while (size > 0 && data[size - 1] == 0x00)
+    {
+        size--;
+    }
+    NalView nal = {data, size, start_code_len_};
+    nals_++;
+    if (on_access_unit_)
+    {
+        if (assembler_.push(nal, &access_unit_))
+        {
+            report_access_unit();
+        }
+        // the assembler skips empty NAL units
+        if (size > 0)
+        {
+            au_offsets_.push_back(au_bytes_.size());
+            au_bytes_.insert(au_bytes_.end(), data, data + size);
+        }
+    }
+    if (on_nal_)
+    {
+        on_nal_(nal);
+    }
+}
+
+// a start code was found behind [data, data + size)
+void NalParser::end_nal(const uint8_t* data, size_t size, int next_start_code_len)
+{
+    if (synced_)
+    {
+        emit(data, size);
+    }
+    synced_ = true;
+    start_code_len_ = next_start_code_len;
+}
+
+void NalParser::push(const uint8_t* data, size_t size)
+{
+    size_t pos = 0;
+    // a start code beginning in the last two bytes held back and ending in data
+    size_t held = std::min<size_t>(tail_.size(), 2);
+    if (held > 0 && size > 0)
+    {
+        uint8_t edge[4];
+        size_t n = std::min<size_t>(size, 2);
+        memcpy(edge, tail_.data() + tail_.size() - held, held);
+        memcpy(edge + held, data, n);
+        size_t i = find_start_code(edge, held + n);
+        if (i < held)
+        {
+            size_t end = tail_.size() - held + i;
+            end_nal(tail_.data(), end, (end > 0 && tail_[end - 1] == 0x00) ? 4 : 3);
+            tail_.clear();
+            pos = 3 - (held - i);
+        }
+    }
+    while (pos < size)
+    {
+        size_t i = pos + find_start_code(data + pos, size - pos);
+        if (i == size)
+        {
+            break;
+        }
+        // the byte in front of the start code, as long as it belongs to the current NAL unit
+        uint8_t before = i > pos ? data[i - 1] : (tail_.empty() ? 0x01 : tail_.back());
+        int start_code_len = before == 0x00 ? 4 : 3;
+        if (tail_.empty())
+        {
+            end_nal(data + pos, i - pos, start_code_len);
+        }
+        else
+        {
+            tail_.insert(tail_.end(), data + pos, data + i);
+            end_nal(tail_.data(), tail_.size(), start_code_len);
+            tail_.clear();
+        }
+        pos = i + 3;
+    }
+    tail_.insert(tail_.end(), data + pos, data + size);
+    if (!synced_ && tail_.size() > 3)
+    {
+        // only a start code split across pushes and the byte in front of it are needed
+        tail_.erase(tail_.begin(), tail_.end() - 3);
+    }
+}
+
+void NalParser::flush()
+{
+    if (synced_ && !tail_.empty())
+    {
+        emit(tail_.data(), tail_.size());
+    }
+    if (on_access_unit_ && assembler_.flush(&access_unit_))
+    {
+        report_access_unit();
+    }
+    tail_.clear();
+    au_bytes_.clear();
+    au_offsets_.clear();
+    synced_ = false;
+    start_code_len_ = 0;
+}
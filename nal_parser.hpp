@@ -0,0 +1,63 @@
+#ifndef __NAL_PARSER_HPP__
+#define __NAL_PARSER_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include "access_unit.hpp"
+#include "nal_reader.hpp"
+#include "noncopyable.hpp"
+
+// Splits an Annex B stream handed over in pieces of any size, as they come from a socket or a
+// pipe. A NAL unit is reported as soon as the start code behind it has arrived, a start code may
+// be split across pushes. NAL units that lie within one push are not copied, only the incomplete
+// one at the end of a push is kept. Bytes in front of the first start code are dropped.
+class NalParser
+{
+public:
+    // the views are only valid during the call
+    typedef std::function<void(const NalView&)> NalCallback;
+    typedef std::function<void(const AccessUnit&)> AccessUnitCallback;
+
+    explicit NalParser(Codec codec);
+
+    void set_nal_callback(const NalCallback& on_nal) { on_nal_ = on_nal; }
+    // access units are grouped as AccessUnitAssembler does, which copies the NAL units of the
+    // current one. An access unit is reported before the NAL unit that completed it.
+    void set_access_unit_callback(const AccessUnitCallback& on_access_unit)
+    {
+        on_access_unit_ = on_access_unit;
+    }
+
+    void push(const uint8_t* data, size_t size);
+    // End of stream: reports the last NAL unit and access unit. The parser can then take the next
+    // stream.
+    void flush();
+
+    // bytes held back for the incomplete NAL unit
+    size_t pending() const { return tail_.size(); }
+    // NAL units reported so far
+    uint64_t nals() const { return nals_; }
+
+    NONCOPYABLE(NalParser);
+
+private:
+    void report_access_unit();
+    void emit(const uint8_t* data, size_t size);
+    void end_nal(const uint8_t* data, size_t size, int next_start_code_len);
+
+private:
+    NalCallback on_nal_;
+    AccessUnitCallback on_access_unit_;
+    AccessUnitAssembler assembler_;
+    AccessUnit access_unit_;
+    std::vector<uint8_t> au_bytes_;   // the NAL units of the current access unit
+    std::vector<size_t> au_offsets_;  // of each of them in au_bytes_
+    std::vector<uint8_t> tail_;       // the NAL unit behind the last start code so far
+    bool synced_;                     // the first start code has been seen
+    int start_code_len_;
+    uint64_t nals_;
+};
+
+#endif  // __NAL_PARSER_HPP__
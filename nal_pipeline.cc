@@ -0,0 +1,218 @@
+#include "nal_pipeline.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
+#include "start_code.hpp"
+
+NalPipeline::NalPipeline(size_t ring_size, size_t block_size, size_t queue_size)
+    : fd_(-1)
+    , block_size_(block_size)
+    , blocks_(queue_size)
+    , nals_(queue_size)
+    , released_(0)
+    , bytes_(0)
+    , ring_full_stalls_(0)
+{
+    // a cut NAL unit leaves the reader at least one block of space
+    size_t n = 1;
+    while (n < ring_size || n < 2 * block_size)
+    {
+        n <<= 1;
+    }
+    ring_.resize(n);
+    mask_ = n - 1;
+}
+
+NalPipeline::~NalPipeline() {}
+
+bool NalPipeline::run(const std::string& filename,
+                      const std::function<void(const NalView&)>& on_nal)
+{
+    bool use_stdin = filename == "-";
+    fd_ = use_stdin ? STDIN_FILENO : ::open(filename.data(), O_RDONLY);
+    if (fd_ < 0)
+    {
+        return false;
+    }
+    std::thread reader(&NalPipeline::read_loop, this);
+    std::thread scanner(&NalPipeline::scan_loop, this);
+    parse_loop(on_nal);
+    reader.join();
+    scanner.join();
+    if (!use_stdin)
+    {
+        ::close(fd_);
+    }
+    fd_ = -1;
+    return true;
+}
+
+PipelineStats NalPipeline::stats() const
+{
+    PipelineStats s;
+    s.bytes = bytes_;
+    s.ring_full_stalls = ring_full_stalls_;
+    s.blocks = blocks_.stats();
+    s.nals = nals_.stats();
+    return s;
+}
+
+void NalPipeline::read_loop()
+{
+    uint64_t write = released_.load(std::memory_order_acquire);
+    while (true)
+    {
+        uint64_t offset = write & mask_;
+        // never across the end of the ring
+        uint64_t n = std::min<uint64_t>(block_size_, ring_.size() - offset);
+        if (write + n - released_.load(std::memory_order_acquire) > ring_.size())
+        {
+            ring_full_stalls_++;
+            int spins = 0;
+            while (write + n - released_.load(std::memory_order_acquire) > ring_.size())
+            {
+                spsc_backoff(&spins);
+            }
+        }
+        ssize_t r = read(fd_, ring_.data() + offset, n);
+        if (r < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (r <= 0)
+        {
+            blocks_.push(PipelineBlock{write, true});
+            return;
+        }
+        write += r;
+        bytes_ += r;
+        blocks_.push(PipelineBlock{write, false});
+    }
+}
+
+// the ring version of find_start_code, patterns running across the end of the ring included
+bool NalPipeline::find_start_code_in(uint64_t from, uint64_t end, uint64_t* pos) const
+{
+    while (from + 3 <= end)
+    {
+        uint64_t offset = from & mask_;
+        uint64_t contiguous = std::min<uint64_t>(end - from, ring_.size() - offset);
+        if (contiguous < 3)
+        {
+            if (at(from) == 0x00 && at(from + 1) == 0x00 && at(from + 2) == 0x01)
+            {
+                *pos = from;
+                return true;
+            }
+            from++;
+            continue;
+        }
+        size_t i = find_start_code(ring_.data() + offset, contiguous);
+        if (i < contiguous)
+        {
+            *pos = from + i;
+            return true;
+        }
+        from += contiguous - 2;
+    }
+    return false;
+}
+
+void NalPipeline::emit(uint64_t begin, uint64_t end, uint64_t release, int start_code_len,
+                       uint8_t flags)
+{
+    if (!(flags & PIPELINE_NAL_SKIP))
+    {
+        // trailing_zero_8bits and the leading zero of a 4 byte start code
+        while (end > begin && at(end - 1) == 0x00)
+        {
+            end--;
+        }
+    }
+    uint32_t size = (uint32_t)(end - begin);
+    nals_.push(PipelineNal{begin, release, size, (uint8_t)start_code_len, flags});
+}
+
+void NalPipeline::scan_loop()
+{
+    uint64_t avail = released_.load(std::memory_order_acquire);
+    bool eof = false;
+    // the pending NAL unit, the bytes in front of the first start code are skipped
+    uint64_t begin = avail;
+    int start_code_len = 0;
+    uint8_t flags = PIPELINE_NAL_SKIP;
+    uint64_t scan = begin;
+    while (true)
+    {
+        uint64_t pos = 0;
+        if (find_start_code_in(scan, avail, &pos))
+        {
+            emit(begin, pos, pos + 3, start_code_len, flags);
+            start_code_len = (pos > begin && at(pos - 1) == 0x00) ? 4 : 3;
+            begin = pos + 3;
+            scan = begin;
+            flags = 0;
+            continue;
+        }
+        // the last two bytes may be the beginning of a start code
+        scan = std::max(scan, avail >= 2 ? avail - 2 : 0);
+        if (eof)
+        {
+            if (avail > begin || (flags & PIPELINE_NAL_SKIP))
+            {
+                emit(begin, avail, avail, start_code_len, flags);
+            }
+            nals_.push(PipelineNal{avail, avail, 0, 0, PIPELINE_NAL_EOF});
+            return;
+        }
+        if (avail - begin >= ring_.size() / 2)
+        {
+            // the reader would wait for space forever, the rest up to the next start code is
+            // skipped
+            emit(begin, scan, scan, start_code_len, flags);
+            begin = scan;
+            flags = PIPELINE_NAL_SKIP;
+        }
+        PipelineBlock block;
+        blocks_.pop(&block);
+        avail = block.end;
+        eof = block.eof;
+    }
+}
+
+void NalPipeline::parse_loop(const std::function<void(const NalView&)>& on_nal)
+{
+    while (true)
+    {
+        PipelineNal d;
+        nals_.pop(&d);
+        if (d.flags & PIPELINE_NAL_EOF)
+        {
+            return;
+        }
+        if (!(d.flags & PIPELINE_NAL_SKIP))
+        {
+            NalView nal;
+            uint64_t offset = d.offset & mask_;
+            if (offset + d.size <= ring_.size())
+            {
+                nal.data = ring_.data() + offset;
+            }
+            else
+            {
+                size_t first = ring_.size() - offset;
+                wrapped_.resize(d.size);
+                memcpy(wrapped_.data(), ring_.data() + offset, first);
+                memcpy(wrapped_.data() + first, ring_.data(), d.size - first);
+                nal.data = wrapped_.data();
+            }
+            nal.size = d.size;
+            nal.start_code_len = d.start_code_len;
+            on_nal(nal);
+        }
+        released_.store(d.release, std::memory_order_release);
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef __NAL_PIPELINE_HPP__
+#define __NAL_PIPELINE_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+#include "nal_reader.hpp"
+#include "noncopyable.hpp"
+#include "spsc_queue.hpp"
+
+// bytes the reader has put into the ring, up to end
+struct PipelineBlock
+{
+    uint64_t end;
+    bool eof;
+};
+
+enum PipelineNalFlag
+{
+    PIPELINE_NAL_EOF = 1,
+    PIPELINE_NAL_SKIP = 2,  // bytes that are no NAL unit and only have to be released
+};
+
+// a NAL unit in the ring, positions count bytes from the start of the stream
+struct PipelineNal
+{
+    uint64_t offset;
+    uint64_t release;  // the ring is free up to here once the NAL unit is parsed
+    uint32_t size;
+    uint8_t start_code_len;
+    uint8_t flags;
+};
+
+struct PipelineStats
+{
+    uint64_t bytes;
+    uint64_t ring_full_stalls;  // reads that had to wait for the parser to release ring space
+    SpscQueueStats blocks;      // reader -> scanner
+    SpscQueueStats nals;        // scanner -> parser
+};
+
+// Splits an Annex B stream into NAL units on three threads: a reader thread read()s the input
+// into a byte ring, a scanner thread finds the start codes in it and the calling thread hands
+// the NAL units to the parser callback. The stages are connected by bounded single producer,
+// single consumer queues of descriptors, so slow reads overlap with scanning and parsing. A NAL
+// unit longer than half the ring is cut.
+class NalPipeline
+{
+public:
+    explicit NalPipeline(size_t ring_size = 64 << 20, size_t block_size = 1 << 20,
+                         size_t queue_size = 4096);
+    ~NalPipeline();
+
+    // filename "-" is stdin. The view passed to on_nal is only valid during the call. Returns
+    // false if the input can not be opened.
+    bool run(const std::string& filename, const std::function<void(const NalView&)>& on_nal);
+
+    // items waiting in the queues right now
+    size_t block_depth() const { return blocks_.depth(); }
+    size_t nal_depth() const { return nals_.depth(); }
+    // complete after run returned
+    PipelineStats stats() const;
+
+    NONCOPYABLE(NalPipeline);
+
+private:
+    void read_loop();
+    void scan_loop();
+    void parse_loop(const std::function<void(const NalView&)>& on_nal);
+    uint8_t at(uint64_t pos) const { return ring_[pos & mask_]; }
+    bool find_start_code_in(uint64_t from, uint64_t end, uint64_t* pos) const;
+    void emit(uint64_t begin, uint64_t end, uint64_t release, int start_code_len, uint8_t flags);
+
+private:
+    int fd_;
+    std::vector<uint8_t> ring_;
+    uint64_t mask_;
+    size_t block_size_;
+    SpscQueue<PipelineBlock> blocks_;
+    SpscQueue<PipelineNal> nals_;
+    std::atomic<uint64_t> released_;  // ring bytes the parser is done with
+    uint64_t bytes_;
+    uint64_t ring_full_stalls_;
+    std::vector<uint8_t> wrapped_;  // NAL units that run across the end of the ring
+};
+
+#endif  // __NAL_PIPELINE_HPP__
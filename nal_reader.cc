@@ -0,0 +1,273 @@
+#include "nal_reader.hpp"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include "start_code.hpp"
+
+NalReader::NalReader(size_t block_size)
+    : fd_(-1)
+    , map_(NULL)
+    , map_size_(0)
+    , block_size_(block_size)
+    , base_(NULL)
+    , pos_(0)
+    , end_(0)
+    , scanned_(0)
+    , start_code_len_(0)
+    , length_size_(0)
+    , eof_(false)
+    , block_reads_(false)
+    , blocks_(block_size)
+{
+}
+
+NalReader::~NalReader() { close(); }
+
+bool NalReader::open(const std::string& filename, ReadMode mode)
+{
+    close();
+    // a duplicate, so close() does not close stdin
+    fd_ = filename == "-" ? dup(STDIN_FILENO) : ::open(filename.data(), O_RDONLY);
+    if (fd_ < 0)
+    {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd_, &st) != 0)
+    {
+        return true;
+    }
+    if (S_ISFIFO(st.st_mode))
+    {
+        // a writer like ffmpeg can then get a whole block ahead before it blocks, not just the
+        // default 64 KiB; unprivileged processes may go up to /proc/sys/fs/pipe-max-size
+        fcntl(fd_, F_SETPIPE_SZ, (int)std::min<size_t>(block_size_, 1 << 20));
+    }
+    if (mode != READ_MAP && S_ISREG(st.st_mode))
+    {
+        block_reads_ = blocks_.open(fd_, st.st_size, mode == READ_AHEAD);
+        return block_reads_;
+    }
+    if (S_ISREG(st.st_mode) && st.st_size > 0)
+    {
+        void* p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (p != MAP_FAILED)
+        {
+            madvise(p, st.st_size, MADV_SEQUENTIAL);
+            map_ = static_cast<uint8_t*>(p);
+            map_size_ = st.st_size;
+            base_ = map_;
+            end_ = map_size_;
+            eof_ = true;
+        }
+    }
+    return true;
+}
+
+void NalReader::close()
+{
+    if (map_)
+    {
+        munmap(map_, map_size_);
+    }
+    blocks_.close();
+    if (fd_ >= 0)
+    {
+        ::close(fd_);
+    }
+    fd_ = -1;
+    map_ = NULL;
+    map_size_ = 0;
+    base_ = NULL;
+    pos_ = 0;
+    end_ = 0;
+    scanned_ = 0;
+    start_code_len_ = 0;
+    eof_ = false;
+    block_reads_ = false;
+}
+
+// Moves the unconsumed bytes to the front of the buffer and appends what one read returns, up to
+// a block. A pipe returns what the writer has produced so far, so a live source is parsed as it
+// arrives rather than a block later.
+bool NalReader::fill()
+{
+    if (eof_)
+    {
+        return false;
+    }
+    if (pos_ > 0)
+    {
+        memmove(buffer_.data(), buffer_.data() + pos_, end_ - pos_);
+        end_ -= pos_;
+        scanned_ -= pos_;
+        pos_ = 0;
+    }
+    if (buffer_.size() - end_ < block_size_)
+    {
+        buffer_.resize(end_ + block_size_);
+    }
+    base_ = buffer_.data();
+    if (block_reads_)
+    {
+        const uint8_t* block = NULL;
+        size_t size = 0;
+        if (!blocks_.next(&block, &size))
+        {
+            eof_ = true;
+            return false;
+        }
+        memcpy(buffer_.data() + end_, block, size);
+        end_ += size;
+        return true;
+    }
+    ssize_t n = 0;
+    do
+    {
+        n = read(fd_, buffer_.data() + end_, block_size_);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+    {
+        eof_ = true;
+        return false;
+    }
+    end_ += n;
+    return true;
+}
+
+// reads until size bytes from pos_ are there or the input ends
+bool NalReader::fill_to(size_t size)
+{
+    while (end_ - pos_ < size)
+    {
+        if (!fill())
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool NalReader::find_start_code_from(size_t from, size_t* offset)
+{
+    scanned_ = std::max(scanned_, from);
+    while (true)
+    {
+        size_t n = end_ - scanned_;
+        size_t i = find_start_code(base_ + scanned_, n);
+        if (i < n)
+        {
+            *offset = scanned_ + i;
+            return true;
+        }
+        // the last two bytes may be the beginning of a start code split across blocks
+        if (end_ >= 2)
+        {
+            scanned_ = std::max(scanned_, end_ - 2);
+        }
+        if (!fill())
+        {
+            return false;
+        }
+    }
+}
+
+int NalReader::start_code_len_at(size_t offset) const
+{
+    return (offset > pos_ && base_[offset - 1] == 0x00) ? 4 : 3;
+}
+
+bool NalReader::find_first_start_code()
+{
+    if (length_size_ > 0)
+    {
+        return true;
+    }
+    size_t offset = 0;
+    if (!find_start_code_from(pos_, &offset))
+    {
+        return false;
+    }
+    start_code_len_ = start_code_len_at(offset);
+    pos_ = offset + 3;
+    scanned_ = pos_;
+    return true;
+}
+
+bool NalReader::skip_to(size_t offset)
+{
+    if (!map_ || offset > map_size_)
+    {
+        return false;
+    }
+    pos_ = offset;
+    scanned_ = offset;
+    start_code_len_ = 0;
+    return true;
+}
+
+// the length says where the next one begins, a NAL unit cut off at the end of the input is
+// returned as far as it goes
+bool NalReader::next_length_prefixed(NalView* nal)
+{
+    if (!fill_to(length_size_))
+    {
+        return false;
+    }
+    size_t size = 0;
+    for (int i = 0; i < length_size_; i++)
+    {
+        size = size << 8 | base_[pos_ + i];
+    }
+    pos_ += length_size_;
+    fill_to(size);
+    size = std::min(size, end_ - pos_);
+    nal->data = base_ + pos_;
+    nal->size = size;
+    nal->start_code_len = length_size_;
+    pos_ += size;
+    return true;
+}
+
+bool NalReader::next(NalView* nal)
+{
+    if (length_size_ > 0)
+    {
+        return next_length_prefixed(nal);
+    }
+    if (pos_ >= end_ && !fill())
+    {
+        return false;
+    }
+    size_t offset = 0;
+    size_t nal_end = 0;
+    size_t next_pos = 0;
+    int next_start_code_len = 0;
+    if (find_start_code_from(pos_, &offset))
+    {
+        nal_end = offset;
+        next_pos = offset + 3;
+        next_start_code_len = start_code_len_at(offset);
+    }
+    else
+    {
+        nal_end = end_;
+        next_pos = end_;
+    }
+    // trailing_zero_8bits and the leading zero of a 4 byte start code
+    while (nal_end > pos_ && base_[nal_end - 1] == 0x00)
+    {
+        nal_end--;
+    }
+    nal->data = base_ + pos_;
+    nal->size = nal_end - pos_;
+    nal->start_code_len = start_code_len_;
+    start_code_len_ = next_start_code_len;
+    pos_ = next_pos;
+    scanned_ = pos_;
+    return true;
+}
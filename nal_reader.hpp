@@ -0,0 +1,97 @@
+#ifndef __NAL_READER_HPP__
+#define __NAL_READER_HPP__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "block_reader.hpp"
+#include "noncopyable.hpp"
+
+enum Codec
+{
+    CODEC_H264,
+    CODEC_H265,
+};
+
+// how NalReader reads regular files, anything else is read()
+enum ReadMode
+{
+    READ_MAP,    // memory mapped
+    READ_AHEAD,  // a BlockReader keeps the next blocks in flight through io_uring
+    READ_PREAD,  // a BlockReader without io_uring
+};
+
+// A NAL unit inside the reader's memory, without start code and trailing zero bytes.
+struct NalView
+{
+    const uint8_t* data;
+    size_t size;
+    int start_code_len;  // 3 or 4, the length size for length prefixed input
+};
+
+// Splits an Annex B byte stream into NAL units. Regular files are memory mapped and the views
+// point straight into the mapping; pipes and other non-seekable inputs are read in large blocks
+// into a buffer that is reused for the whole stream, only the incomplete NAL unit at its end is
+// moved to the front before the next read. Regular files can also be read that way, with the next
+// blocks read ahead through io_uring, which beats page faults on a mapping of cold data.
+// Length prefixed input (the MP4 sample layout) is split by its lengths, no byte is scanned.
+class NalReader
+{
+public:
+    explicit NalReader(size_t block_size = 1 << 20);
+    ~NalReader();
+
+    // filename "-" is stdin
+    bool open(const std::string& filename, ReadMode mode = READ_MAP);
+    void close();
+    bool mapped() const { return map_ != NULL; }
+    // a regular file read by a BlockReader
+    bool block_reads() const { return block_reads_; }
+    bool uring() const { return blocks_.uring(); }
+    // the whole file in mapped mode
+    const uint8_t* map_data() const { return map_; }
+    size_t map_size() const { return map_size_; }
+
+    // 0 for Annex B, else every NAL unit has a big endian length of 1, 2 or 4 bytes in front.
+    void set_length_size(int length_size) { length_size_ = length_size; }
+    int length_size() const { return length_size_; }
+
+    // Skips everything up to and including the first start code, nothing for length prefixed
+    // input.
+    bool find_first_start_code();
+
+    // Mapped mode only: continues at offset, where a start code or a length begins.
+    bool skip_to(size_t offset);
+
+    // Returns the next NAL unit. In buffered mode the view stays valid until the next call,
+    // in mapped mode until close().
+    bool next(NalView* nal);
+
+    NONCOPYABLE(NalReader);
+
+private:
+    bool fill();
+    bool fill_to(size_t size);
+    bool next_length_prefixed(NalView* nal);
+    bool find_start_code_from(size_t from, size_t* offset);
+    int start_code_len_at(size_t offset) const;
+
+private:
+    int fd_;
+    uint8_t* map_;
+    size_t map_size_;
+    std::vector<uint8_t> buffer_;
+    size_t block_size_;
+    const uint8_t* base_;
+    size_t pos_;
+    size_t end_;
+    size_t scanned_;
+    int start_code_len_;
+    int length_size_;
+    bool eof_;
+    bool block_reads_;
+    BlockReader blocks_;
+};
+
+#endif  // __NAL_READER_HPP__
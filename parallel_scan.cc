@@ -0,0 +1,243 @@
+#include "parallel_scan.hpp"
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "h264.hpp"
+#include "h265_sps.hpp"
+#include "param_set_cache.hpp"
+#include "scoped_exit.hpp"
+#include "start_code.hpp"
+
+// smaller chunks are not worth a thread
+#define PARALLEL_SCAN_MIN_CHUNK (256 << 10)
+
+// a parameter set payload and the record it was last seen in
+struct ParamSetRef
+{
+    uint64_t hash;
+    size_t record;
+};
+
+struct Chunk
+{
+    size_t begin;
+    size_t end;
+    std::vector<size_t> start_codes;  // offsets of the 00 00 01 patterns beginning in the chunk
+    size_t next_start_code;           // the first one behind the chunk, or the file size
+    size_t first_record;
+    std::vector<ParamSetRef> param_sets;  // every distinct payload of the chunk
+    std::vector<ParamSetRef> primer;      // the ones the chunks in front left behind
+};
+
+// runs f(0) .. f(n - 1) on n threads, the calling one included
+template <typename F>
+static void run_workers(int n, F f)
+{
+    std::vector<std::thread> workers;
+    for (int i = 1; i < n; i++)
+    {
+        workers.emplace_back(f, i);
+    }
+    f(0);
+    for (auto& t : workers)
+    {
+        t.join();
+    }
+}
+
+static void scan_chunk(const uint8_t* data, size_t size, Chunk* c)
+{
+    // a start code beginning in the last two bytes of the chunk reaches into the next one
+    size_t limit = std::min(c->end + 2, size);
+    size_t i = c->begin;
+    while (i < limit)
+    {
+        size_t n = find_start_code(data + i, limit - i);
+        if (n == limit - i || i + n >= c->end)
+        {
+            break;
+        }
+        c->start_codes.push_back(i + n);
+        i += n + 3;
+    }
+}
+
+static int nal_unit_type_of(Codec codec, uint8_t header)
+{
+    return codec == CODEC_H264 ? header & 0x1f : (header >> 1) & 0x3f;
+}
+
+static bool is_param_set(Codec codec, int nal_unit_type)
+{
+    if (codec == CODEC_H264)
+    {
+        return nal_unit_type == H264_NAL_UNIT_TYPE_SPS || nal_unit_type == H264_NAL_UNIT_TYPE_PPS;
+    }
+    return nal_unit_type >= NAL_UNIT_VPS && nal_unit_type <= NAL_UNIT_PPS;
+}
+
+// Keeps the last occurrence of every distinct payload. Parsing those in file order leaves each
+// parameter set id with the payload it was last sent with, which is the state a sequential parse
+// would have reached.
+static void add_param_set(std::vector<ParamSetRef>* refs, const uint8_t* data,
+                          const NalRecord* records, const ParamSetRef& ref)
+{
+    const NalRecord& r = records[ref.record];
+    for (auto& e : *refs)
+    {
+        const NalRecord& o = records[e.record];
+        if (e.hash == ref.hash && o.size == r.size
+            && memcmp(data + o.offset, data + r.offset, r.size) == 0)
+        {
+            e.record = std::max(e.record, ref.record);
+            return;
+        }
+    }
+    refs->push_back(ref);
+}
+
+static void fill_records(const uint8_t* data, Codec codec, Chunk* c, NalRecord* records)
+{
+    size_t count = c->start_codes.size();
+    for (size_t i = 0; i < count; i++)
+    {
+        size_t p = c->start_codes[i];
+        size_t begin = p + 3;
+        size_t end = i + 1 < count ? c->start_codes[i + 1] : c->next_start_code;
+        // trailing_zero_8bits and the leading zero of a 4 byte start code
+        while (end > begin && data[end - 1] == 0x00)
+        {
+            end--;
+        }
+        size_t index = c->first_record + i;
+        NalRecord& r = records[index];
+        r.offset = begin;
+        r.size = (uint32_t)(end - begin);
+        r.start_code_len = (p > 0 && data[p - 1] == 0x00) ? 4 : 3;
+        r.nal_unit_type = r.size > 0 ? nal_unit_type_of(codec, data[begin]) : 0;
+        r.slice_type = -1;
+        r.flags = 0;
+        if (r.size > 0 && is_param_set(codec, r.nal_unit_type))
+        {
+            ParamSetRef ref = {param_set_hash(data + r.offset, r.size), index};
+            add_param_set(&c->param_sets, data, records, ref);
+        }
+    }
+}
+
+static bool by_record(const ParamSetRef& a, const ParamSetRef& b) { return a.record < b.record; }
+
+static void parse_h264_chunk(const uint8_t* data, const Chunk& c, NalRecord* records)
+{
+    h264_stream_t* h = h264_new();
+    auto stream_free = make_scoped_exit([&h]() { h264_free(h); });
+    for (const auto& ref : c.primer)
+    {
+        const NalRecord& r = records[ref.record];
+        h264_read_nal_unit(h, data + r.offset, r.size);
+    }
+    NalRecord* end = records + c.first_record + c.start_codes.size();
+    for (NalRecord* r = records + c.first_record; r < end; r++)
+    {
+        if (h264_read_nal_unit(h, data + r->offset, r->size) < 0)
+        {
+            r->flags |= NAL_RECORD_BROKEN;
+            continue;
+        }
+        if (r->nal_unit_type == H264_NAL_UNIT_TYPE_CODED_SLICE_NON_IDR
+            || r->nal_unit_type == H264_NAL_UNIT_TYPE_CODED_SLICE_IDR)
+        {
+            r->slice_type = (int8_t)h->sh.slice_type;
+            r->flags |= h->sh.first_mb_in_slice == 0 ? NAL_RECORD_FIRST_SLICE : 0;
+        }
+    }
+}
+
+static void parse_h265_chunk(const uint8_t* data, const Chunk& c, NalRecord* records)
+{
+    h265_stream_t* h = h265_new();
+    auto stream_free = make_scoped_exit([&h]() { h265_free(h); });
+    h->sh->read_slice_type = 1;
+    // h265_read_nal_unit does not write to buf
+    uint8_t* buf = const_cast<uint8_t*>(data);
+    for (const auto& ref : c.primer)
+    {
+        const NalRecord& r = records[ref.record];
+        h265_read_nal_unit(h, buf + r.offset, r.size);
+    }
+    NalRecord* end = records + c.first_record + c.start_codes.size();
+    for (NalRecord* r = records + c.first_record; r < end; r++)
+    {
+        if (h265_read_nal_unit(h, buf + r->offset, r->size) < 0)
+        {
+            r->flags |= NAL_RECORD_BROKEN;
+            continue;
+        }
+        if (h->nal->parsed == h->sh)
+        {
+            r->slice_type = (int8_t)h->sh->slice_type;
+            r->flags |= h->sh->first_slice_segment_in_pic_flag ? NAL_RECORD_FIRST_SLICE : 0;
+        }
+    }
+}
+
+bool parallel_scan(const uint8_t* data, size_t size, Codec codec, int threads,
+                   std::vector<NalRecord>* nals)
+{
+    nals->clear();
+    size_t n = std::max<size_t>(1, std::min<size_t>(threads, size / PARALLEL_SCAN_MIN_CHUNK));
+    std::vector<Chunk> chunks(n);
+    for (size_t k = 0; k < n; k++)
+    {
+        chunks[k].begin = size * k / n;
+        chunks[k].end = size * (k + 1) / n;
+    }
+    run_workers(n, [&](int k) { scan_chunk(data, size, &chunks[k]); });
+
+    // stitch the chunk edges: the last NAL unit of a chunk ends at the next start code found by
+    // any of the chunks behind it
+    size_t next = size;
+    for (size_t k = n; k-- > 0;)
+    {
+        chunks[k].next_start_code = next;
+        if (!chunks[k].start_codes.empty())
+        {
+            next = chunks[k].start_codes.front();
+        }
+    }
+    size_t total = 0;
+    for (auto& c : chunks)
+    {
+        c.first_record = total;
+        total += c.start_codes.size();
+    }
+    if (total == 0)
+    {
+        return false;
+    }
+    nals->resize(total);
+    NalRecord* records = nals->data();
+    run_workers(n, [&](int k) { fill_records(data, codec, &chunks[k], records); });
+
+    std::vector<ParamSetRef> live;
+    for (auto& c : chunks)
+    {
+        c.primer = live;
+        std::sort(c.primer.begin(), c.primer.end(), by_record);
+        for (const auto& ref : c.param_sets)
+        {
+            add_param_set(&live, data, records, ref);
+        }
+    }
+    run_workers(n, [&](int k) {
+        if (codec == CODEC_H264)
+        {
+            parse_h264_chunk(data, chunks[k], records);
+        }
+        else
+        {
+            parse_h265_chunk(data, chunks[k], records);
+        }
+    });
+    return true;
+}
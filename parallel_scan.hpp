@@ -0,0 +1,34 @@
+#ifndef __PARALLEL_SCAN_HPP__
+#define __PARALLEL_SCAN_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "nal_reader.hpp"
+
+enum NalRecordFlag
+{
+    NAL_RECORD_FIRST_SLICE = 1,  // first_mb_in_slice 0 / first_slice_segment_in_pic_flag
+    NAL_RECORD_BROKEN = 2,       // the parser rejected the NAL unit
+};
+
+// One NAL unit of a scanned file.
+struct NalRecord
+{
+    uint64_t offset;  // of the NAL header, the start code is in front of it
+    uint32_t size;    // without trailing zero bytes
+    uint8_t start_code_len;
+    uint8_t nal_unit_type;
+    int8_t slice_type;  // -1 if the NAL unit is not a parsed slice
+    uint8_t flags;
+};
+
+// Splits data into one chunk per thread. Every worker finds the start codes in its chunk, the NAL
+// unit running past the end of a chunk is closed by the first start code of the following ones,
+// and then the headers are parsed with a parser state per worker. A worker first parses the
+// parameter sets the chunks in front of it left behind, so its slices see the ones a sequential
+// parse would. nals receives the records in file order. Returns false if data has no start code.
+bool parallel_scan(const uint8_t* data, size_t size, Codec codec, int threads,
+                   std::vector<NalRecord>* nals);
+
+#endif  // __PARALLEL_SCAN_HPP__
@@ -0,0 +1,63 @@
+#include "param_set_cache.hpp"
+#include <stdlib.h>
+#include <string.h>
+
+#define PARAM_SET_HASH_MUL 0x9E3779B97F4A7C15ull
+
+static inline uint64_t param_set_mix(uint64_t h, uint64_t word)
+{
+    h = (h ^ word) * PARAM_SET_HASH_MUL;
+    return h ^ (h >> 29);
+}
+
+// eight bytes per step, parameter sets are a few dozen bytes long
+uint64_t param_set_hash(const uint8_t* p, size_t size)
+{
+    uint64_t h = param_set_mix(0, size);
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, p + i, 8);
+        h = param_set_mix(h, word);
+    }
+    if (i < size)
+    {
+        uint64_t word = 0;
+        memcpy(&word, p + i, size - i);
+        h = param_set_mix(h, word);
+    }
+    return h;
+}
+
+int param_set_key_equal(const param_set_key_t* key, uint64_t hash, const uint8_t* p, int size)
+{
+    return key->data && key->hash == hash && key->size == size && memcmp(key->data, p, size) == 0;
+}
+
+void param_set_key_assign(param_set_key_t* key, uint64_t hash, const uint8_t* p, int size)
+{
+    if (!key->data || key->capacity < size)
+    {
+        free(key->data);
+        key->capacity = size > 0 ? size : 1;
+        key->data = (uint8_t*)malloc(key->capacity);
+    }
+    memcpy(key->data, p, size);
+    key->hash = hash;
+    key->size = size;
+}
+
+void param_set_key_clear(param_set_key_t* key)
+{
+    key->hash = 0;
+    key->size = -1;
+}
+
+void param_set_key_free(param_set_key_t* key)
+{
+    free(key->data);
+    key->data = NULL;
+    key->size = -1;
+    key->capacity = 0;
+}
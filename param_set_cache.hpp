@@ -0,0 +1,36 @@
+#ifndef __PARAM_SET_CACHE_HPP__
+#define __PARAM_SET_CACHE_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The escaped payload a parameter set table entry was parsed from. Encoders repeat VPS/SPS/PPS
+// in front of every keyframe, so a parameter set that comes again unchanged is recognised with a
+// hash and a memcmp and the table entry is kept instead of being parsed again.
+typedef struct
+{
+    uint64_t hash;
+    uint8_t* data;
+    int size;  // -1 after clear
+    int capacity;
+} param_set_key_t;
+
+typedef struct
+{
+    uint64_t hits;
+    uint64_t misses;
+} param_set_cache_stats_t;
+
+uint64_t param_set_hash(const uint8_t* p, size_t size);
+
+// 1 if key holds exactly the size bytes at p, hash being param_set_hash(p, size)
+int param_set_key_equal(const param_set_key_t* key, uint64_t hash, const uint8_t* p, int size);
+
+void param_set_key_assign(param_set_key_t* key, uint64_t hash, const uint8_t* p, int size);
+
+// forgets the payload, keeps the memory for the next assign
+void param_set_key_clear(param_set_key_t* key);
+
+void param_set_key_free(param_set_key_t* key);
+
+#endif  // __PARAM_SET_CACHE_HPP__
@@ -0,0 +1,126 @@
+#include "param_set_store.hpp"
+
+ParamSetStore::ParamSetStore(Codec codec)
+    : codec_(codec)
+    , h264_(NULL)
+    , h265_(NULL)
+    , vps_(16)
+    , sps_(32)
+    , pps_(256)
+{
+    if (codec_ == CODEC_H264)
+    {
+        h264_ = h264_new();
+    }
+    else
+    {
+        h265_ = h265_new();
+        h265_->sh->read_slice_type = 1;
+    }
+}
+
+ParamSetStore::~ParamSetStore()
+{
+    h264_free(h264_);
+    h265_free(h265_);
+}
+
+bool ParamSetStore::push(const NalView& nal)
+{
+    if (nal.size == 0)
+    {
+        return false;
+    }
+    std::vector<uint8_t>* set = NULL;
+    if (codec_ == CODEC_H264)
+    {
+        int nal_unit_type = nal.data[0] & 0x1f;
+        if (nal_unit_type != H264_NAL_UNIT_TYPE_SPS && nal_unit_type != H264_NAL_UNIT_TYPE_PPS)
+        {
+            return false;
+        }
+        if (h264_read_nal_unit(h264_, nal.data, nal.size) < 0)
+        {
+            return false;
+        }
+        if (nal_unit_type == H264_NAL_UNIT_TYPE_SPS && h264_->sps)
+        {
+            set = &sps_[h264_->sps->seq_parameter_set_id & 31];
+        }
+        else if (nal_unit_type == H264_NAL_UNIT_TYPE_PPS && h264_->pps)
+        {
+            set = &pps_[h264_->pps->pic_parameter_set_id & 255];
+        }
+    }
+    else
+    {
+        int nal_unit_type = (nal.data[0] >> 1) & 0x3f;
+        if (nal_unit_type < NAL_UNIT_VPS || nal_unit_type > NAL_UNIT_PPS)
+        {
+            return false;
+        }
+        // h265_read_nal_unit does not write to buf
+        if (h265_read_nal_unit(h265_, const_cast<uint8_t*>(nal.data), nal.size) < 0)
+        {
+            return false;
+        }
+        if (nal_unit_type == NAL_UNIT_VPS && h265_->vps)
+        {
+            set = &vps_[h265_->vps->vps_video_parameter_set_id & 15];
+        }
+        else if (nal_unit_type == NAL_UNIT_SPS && h265_->sps)
+        {
+            set = &sps_[h265_->sps->sps_seq_parameter_set_id & 15];
+        }
+        else if (nal_unit_type == NAL_UNIT_PPS && h265_->pps)
+        {
+            set = &pps_[h265_->pps->pps_pic_parameter_set_id & 63];
+        }
+    }
+    if (!set)
+    {
+        return false;
+    }
+    set->assign(nal.data, nal.data + nal.size);
+    return true;
+}
+
+int ParamSetStore::active_sets(const NalView& slice, const std::vector<uint8_t>* sets[3])
+{
+    int count = 0;
+    if (codec_ == CODEC_H264)
+    {
+        bool parsed = h264_read_nal_unit(h264_, slice.data, slice.size) >= 0;
+        int pps_id = parsed ? h264_->sh.pic_parameter_set_id : -1;
+        const h264_pps_t* pps = pps_id >= 0 && pps_id < 256 ? h264_->pps_table[pps_id] : NULL;
+        if (pps && pps->seq_parameter_set_id < 32)
+        {
+            sets[count++] = &sps_[pps->seq_parameter_set_id];
+            sets[count++] = &pps_[pps_id];
+        }
+    }
+    else
+    {
+        // h265_read_nal_unit does not write to buf
+        bool parsed = h265_read_nal_unit(h265_, const_cast<uint8_t*>(slice.data), slice.size) >= 0
+                      && h265_->nal->parsed == h265_->sh;
+        int pps_id = parsed ? h265_->sh->slice_pic_parameter_set_id : -1;
+        const h265_pps_t* pps = pps_id >= 0 && pps_id < 64 ? h265_->pps_table[pps_id] : NULL;
+        int sps_id = pps ? pps->pps_seq_parameter_set_id : -1;
+        const h265_sps_t* sps = sps_id >= 0 && sps_id < 16 ? h265_->sps_table[sps_id] : NULL;
+        if (sps)
+        {
+            sets[count++] = &vps_[sps->sps_video_parameter_set_id & 15];
+            sets[count++] = &sps_[sps_id];
+            sets[count++] = &pps_[pps_id];
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (sets[i]->empty())
+        {
+            return 0;
+        }
+    }
+    return count;
+}
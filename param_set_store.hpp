@@ -0,0 +1,47 @@
+#ifndef __PARAM_SET_STORE_HPP__
+#define __PARAM_SET_STORE_HPP__
+
+#include <stdint.h>
+#include <vector>
+#include "h264.hpp"
+#include "h265_sps.hpp"
+#include "nal_reader.hpp"
+#include "noncopyable.hpp"
+
+// The latest payload, header included, of every parameter set id of a stream, for writers that
+// have to repeat them elsewhere. The parser that read the ids is kept for the fields of the
+// parsed sets, and may parse other NAL units of the same stream as well.
+class ParamSetStore
+{
+public:
+    explicit ParamSetStore(Codec codec);
+    ~ParamSetStore();
+
+    // Parses nal if it is a parameter set and keeps a copy. Returns false for any other NAL unit
+    // and for a parameter set the parser rejected.
+    bool push(const NalView& nal);
+
+    // Parses the slice and points sets at the payloads of the parameter sets it refers to, the VPS
+    // first. Returns how many, 0 if the slice is broken or one of them has not been seen.
+    int active_sets(const NalView& slice, const std::vector<uint8_t>* sets[3]);
+
+    // indexed by id, an empty payload for an id not seen
+    const std::vector<std::vector<uint8_t>>& vps() const { return vps_; }
+    const std::vector<std::vector<uint8_t>>& sps() const { return sps_; }
+    const std::vector<std::vector<uint8_t>>& pps() const { return pps_; }
+
+    h264_stream_t* h264() const { return h264_; }
+    h265_stream_t* h265() const { return h265_; }
+
+    NONCOPYABLE(ParamSetStore);
+
+private:
+    Codec codec_;
+    h264_stream_t* h264_;
+    h265_stream_t* h265_;
+    std::vector<std::vector<uint8_t>> vps_;
+    std::vector<std::vector<uint8_t>> sps_;
+    std::vector<std::vector<uint8_t>> pps_;
+};
+
+#endif  // __PARAM_SET_STORE_HPP__
@@ -0,0 +1,29 @@
+#include "rbsp.hpp"
+#include <string.h>
+#include <algorithm>
+#include "start_code.hpp"
+
+size_t unescape_rbsp(const uint8_t* src, size_t size, uint8_t* dst, size_t max_out)
+{
+    size_t in = 0;
+    size_t out = 0;
+    while (in < size && out < max_out)
+    {
+        size_t room = max_out - out;
+        // one byte past room, so any 00 00 03 found still fits in the output
+        size_t window = std::min(size - in, room + 1);
+        size_t found = find_emulation_prevention(src + in, window);
+        size_t run = std::min(found < window ? found + 2 : window, room);
+        if (dst + out != src + in)
+        {
+            memmove(dst + out, src + in, run);
+        }
+        out += run;
+        in += run;
+        if (found < window)
+        {
+            in++;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,13 @@
+#ifndef __RBSP_HPP__
+#define __RBSP_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Removes emulation prevention bytes (the 03 of every 00 00 03) from the escaped payload src and
+// writes at most max_out bytes of rbsp to dst. dst may be src to unescape in place. Clean runs
+// between emulation prevention bytes are located with find_emulation_prevention and copied in
+// one go. Returns the number of bytes written.
+size_t unescape_rbsp(const uint8_t* src, size_t size, uint8_t* dst, size_t max_out);
+
+#endif  // __RBSP_HPP__
@@ -2,9 +2,37 @@
 #define __READ_BITS_HPP__
 
 #include <stdint.h>
-#include <assert.h>
+#include <string.h>
 #include "noncopyable.hpp"
 
+// Returns the 64 bits that start bit_offset (0..7) bits into p, most significant bit first.
+// Bytes at or past end read as zero, so callers never fault on a truncated NAL.
+static inline uint64_t peek_bits_64(const uint8_t *p, const uint8_t *end, unsigned bit_offset)
+{
+    uint64_t cache = 0;
+    if (p + 8 <= end)
+    {
+        memcpy(&cache, p, 8);
+        cache = __builtin_bswap64(cache);
+    }
+    else
+    {
+        for (int i = 0; i < 8; i++)
+        {
+            cache = (cache << 8) | (p + i < end ? p[i] : 0);
+        }
+    }
+    return cache << bit_offset;
+}
+
+// A ue(v) code of up to 57 bits fits in the cache together with a bit offset of up to 7.
+#define UE_MAX_CACHED_LEADING_ZEROS 28
+
+static inline int count_leading_zeros_64(uint64_t cache)
+{
+    return cache ? __builtin_clzll(cache) : 64;
+}
+
 class ReadBit
 {
 public:
@@ -13,34 +41,65 @@ public:
         , length_(len)
         , current_bit_(0) {};
     ~ReadBit() = default;
-    unsigned int read_bit()
+    unsigned int read_bit() { return read_n_bits(1); }
+    // n <= 32
+    unsigned int peek_n_bits(int n) const
     {
-        assert(current_bit_ <= length_ * 8);
-        int index = current_bit_ / 8;
-        int offset = current_bit_ % 8 + 1;
-
-        current_bit_++;
-        return (start_[index] >> (8 - offset)) & 0x01;
+        if (n == 0)
+        {
+            return 0;
+        }
+        return (unsigned int)(cache() >> (64 - n));
     }
     unsigned int read_n_bits(int n)
     {
-        int r = 0;
-        int i;
-        for (i = 0; i < n; i++)
+        unsigned int r = peek_n_bits(n);
+        current_bit_ += n;
+        return r;
+    }
+    void skip_n_bits(uint64_t n) { current_bit_ += n; }
+    unsigned int read_ue()
+    {
+        uint64_t c = cache();
+        int leading_zeros = count_leading_zeros_64(c);
+        if (leading_zeros > 31)
         {
-            r |= (read_bit() << (n - i - 1));
+            // corrupt or truncated
+            current_bit_ += 32;
+            return 0;
         }
-        return r;
+        if (leading_zeros <= UE_MAX_CACHED_LEADING_ZEROS)
+        {
+            int bits = 2 * leading_zeros + 1;
+            current_bit_ += bits;
+            return (unsigned int)((c >> (64 - bits)) - 1);
+        }
+        current_bit_ += leading_zeros + 1;
+        return read_n_bits(leading_zeros) + ((1u << leading_zeros) - 1);
+    }
+    int read_se()
+    {
+        unsigned int r = read_ue();
+        return (r & 0x01) ? (int)((r + 1) / 2) : -(int)(r / 2);
     }
+    bool byte_aligned() const { return (current_bit_ & 7) == 0; }
+    uint64_t position() const { return current_bit_; }
+    bool eof() const { return current_bit_ >= length_ * 8; }
 
     NONCOPYABLE(ReadBit);
 
+private:
+    uint64_t cache() const
+    {
+        const uint8_t *end = start_ + length_;
+        const uint8_t *p = start_ + (current_bit_ >> 3);
+        return peek_bits_64(p < end ? p : end, end, current_bit_ & 7);
+    }
+
 private:
     const uint8_t *start_;
     uint64_t length_;
     uint64_t current_bit_;
 };
 
-
-
-#endif // __READ_BITS_HPP__
+#endif  // __READ_BITS_HPP__
@@ -0,0 +1,148 @@
+#ifndef __SPSC_QUEUE_HPP__
+#define __SPSC_QUEUE_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "noncopyable.hpp"
+
+// Waits a little longer on every call: spins first, then yields, then sleeps.
+static inline void spsc_backoff(int* spins)
+{
+    int n = (*spins)++;
+    if (n < 64)
+    {
+        return;
+    }
+    if (n < 128)
+    {
+        std::this_thread::yield();
+        return;
+    }
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+}
+
+// Counters of one queue. The producer side is written by the producer only, empty_stalls by the
+// consumer only, read them after both threads are done.
+struct SpscQueueStats
+{
+    uint64_t pushed;
+    uint64_t full_stalls;   // pushes that had to wait for the consumer
+    uint64_t empty_stalls;  // pops that had to wait for the producer
+    uint64_t max_depth;
+    uint64_t depth_sum;  // depth after every push, divide by pushed for the mean
+};
+
+// Bounded ring of items for exactly one producer and one consumer thread.
+template <typename T>
+class SpscQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit SpscQueue(size_t capacity)
+        : head_(0)
+        , tail_cache_(0)
+        , tail_(0)
+        , head_cache_(0)
+        , stats_()
+    {
+        size_t n = 1;
+        while (n < capacity)
+        {
+            n <<= 1;
+        }
+        items_.resize(n);
+        mask_ = n - 1;
+    }
+
+    // producer side
+    bool try_push(const T& item)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_cache_ > mask_)
+        {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            if (tail - head_cache_ > mask_)
+            {
+                return false;
+            }
+        }
+        items_[tail & mask_] = item;
+        tail_.store(tail + 1, std::memory_order_release);
+        uint64_t depth = tail + 1 - head_cache_;
+        stats_.pushed++;
+        stats_.depth_sum += depth;
+        stats_.max_depth = depth > stats_.max_depth ? depth : stats_.max_depth;
+        return true;
+    }
+    void push(const T& item)
+    {
+        if (try_push(item))
+        {
+            return;
+        }
+        stats_.full_stalls++;
+        int spins = 0;
+        while (!try_push(item))
+        {
+            spsc_backoff(&spins);
+        }
+    }
+
+    // consumer side
+    bool try_pop(T* item)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_cache_)
+        {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            if (head == tail_cache_)
+            {
+                return false;
+            }
+        }
+        *item = items_[head & mask_];
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    void pop(T* item)
+    {
+        if (try_pop(item))
+        {
+            return;
+        }
+        stats_.empty_stalls++;
+        int spins = 0;
+        while (!try_pop(item))
+        {
+            spsc_backoff(&spins);
+        }
+    }
+
+    // items in the queue right now, from any thread
+    size_t depth() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+    const SpscQueueStats& stats() const { return stats_; }
+
+    NONCOPYABLE(SpscQueue);
+
+private:
+    std::vector<T> items_;
+    size_t mask_;
+    // consumer cache line
+    std::atomic<size_t> head_;
+    size_t tail_cache_;
+    char pad0_[64];
+    // producer cache line
+    std::atomic<size_t> tail_;
+    size_t head_cache_;
+    char pad1_[64];
+    SpscQueueStats stats_;
+};
+
+#endif  // __SPSC_QUEUE_HPP__
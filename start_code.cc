@@ -0,0 +1,114 @@
+#include "start_code.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define START_CODE_X86 1
+#endif
+
+// all scanners look for the three byte pattern 00 00 <third>
+
+static size_t find_zero_zero_scalar(const uint8_t* p, size_t n, uint8_t third)
+{
+    size_t i = 0;
+    while (i + 2 < n)
+    {
+        // p[i + 2] can neither end a pattern at i nor start one at i + 1 or i + 2
+        if (p[i + 2] != 0x00 && p[i + 2] != third)
+        {
+            i += 3;
+            continue;
+        }
+        if (p[i] == 0x00 && p[i + 1] == 0x00 && p[i + 2] == third)
+        {
+            return i;
+        }
+        i++;
+    }
+    return n;
+}
+
+#ifdef START_CODE_X86
+__attribute__((target("sse2"))) static size_t find_zero_zero_sse2(const uint8_t* p,
+                                                                  size_t n,
+                                                                  uint8_t third)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i tail = _mm_set1_epi8(third);
+    size_t i = 0;
+    for (; i + 18 <= n; i += 16)
+    {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(p + i));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(p + i + 1));
+        __m128i b2 = _mm_loadu_si128((const __m128i*)(p + i + 2));
+        __m128i hit = _mm_and_si128(
+            _mm_and_si128(_mm_cmpeq_epi8(b0, zero), _mm_cmpeq_epi8(b1, zero)),
+            _mm_cmpeq_epi8(b2, tail));
+        int mask = _mm_movemask_epi8(hit);
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_zero_zero_scalar(p + i, n - i, third);
+}
+
+__attribute__((target("avx2"))) static size_t find_zero_zero_avx2(const uint8_t* p,
+                                                                  size_t n,
+                                                                  uint8_t third)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i tail = _mm256_set1_epi8(third);
+    size_t i = 0;
+    for (; i + 34 <= n; i += 32)
+    {
+        __m256i b0 = _mm256_loadu_si256((const __m256i*)(p + i));
+        __m256i b1 = _mm256_loadu_si256((const __m256i*)(p + i + 1));
+        __m256i b2 = _mm256_loadu_si256((const __m256i*)(p + i + 2));
+        __m256i hit = _mm256_and_si256(
+            _mm256_and_si256(_mm256_cmpeq_epi8(b0, zero), _mm256_cmpeq_epi8(b1, zero)),
+            _mm256_cmpeq_epi8(b2, tail));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if (mask)
+        {
+            return i + __builtin_ctz(mask);
+        }
+    }
+    return i + find_zero_zero_sse2(p + i, n - i, third);
+}
+#endif
+
+typedef size_t (*find_zero_zero_fn)(const uint8_t* p, size_t n, uint8_t third);
+
+struct Scanner
+{
+    find_zero_zero_fn fn;
+    const char* name;
+};
+
+static Scanner select_scanner()
+{
+#ifdef START_CODE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        return Scanner{find_zero_zero_avx2, "avx2"};
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        return Scanner{find_zero_zero_sse2, "sse2"};
+    }
+#endif
+    return Scanner{find_zero_zero_scalar, "scalar"};
+}
+
+static const Scanner& scanner()
+{
+    static const Scanner s = select_scanner();
+    return s;
+}
+
+size_t find_start_code(const uint8_t* p, size_t n) { return scanner().fn(p, n, 0x01); }
+
+size_t find_emulation_prevention(const uint8_t* p, size_t n) { return scanner().fn(p, n, 0x03); }
+
+const char* start_code_scanner_name() { return scanner().name; }
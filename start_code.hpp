@@ -0,0 +1,18 @@
+#ifndef __START_CODE_HPP__
+#define __START_CODE_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Returns the offset of the first 00 00 01 start code prefix in [p, p + n), or n if there is none.
+// The fastest implementation supported by the running cpu (avx2, sse2, scalar) is picked on the
+// first call.
+size_t find_start_code(const uint8_t* p, size_t n);
+
+// Returns the offset of the first 00 00 03 emulation prevention sequence in [p, p + n), or n.
+size_t find_emulation_prevention(const uint8_t* p, size_t n);
+
+// Name of the implementation find_start_code and find_emulation_prevention dispatch to.
+const char* start_code_scanner_name();
+
+#endif  // __START_CODE_HPP__
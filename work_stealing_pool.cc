@@ -0,0 +1,117 @@
+#include "work_stealing_pool.hpp"
+
+// the pool and deque the current thread works on
+static thread_local const WorkStealingPool* tls_pool = NULL;
+static thread_local size_t tls_worker = 0;
+
+WorkStealingPool::WorkStealingPool(int threads)
+    : queued_(0)
+    , pending_(0)
+    , next_(0)
+    , stop_(false)
+    , steals_(0)
+{
+    size_t n = threads > 0 ? threads : 1;
+    for (size_t i = 0; i < n; i++)
+    {
+        workers_.emplace_back(new Worker());
+    }
+    for (size_t i = 0; i < n; i++)
+    {
+        threads_.emplace_back(&WorkStealingPool::worker_loop, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool()
+{
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& t : threads_)
+    {
+        t.join();
+    }
+}
+
+void WorkStealingPool::submit(std::function<void()> task)
+{
+    size_t index = 0;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        index = tls_pool == this ? tls_worker : next_++ % workers_.size();
+        queued_++;
+        pending_++;
+    }
+    {
+        std::lock_guard<std::mutex> lock(workers_[index]->mutex);
+        workers_[index]->tasks.push_back(std::move(task));
+    }
+    work_cv_.notify_one();
+}
+
+void WorkStealingPool::wait()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this]() { return pending_ == 0; });
+}
+
+bool WorkStealingPool::pop_or_steal(size_t index, std::function<void()>* task)
+{
+    {
+        Worker& own = *workers_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+            *task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    for (size_t i = 1; i < workers_.size(); i++)
+    {
+        Worker& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+            *task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void WorkStealingPool::worker_loop(size_t index)
+{
+    tls_pool = this;
+    tls_worker = index;
+    while (true)
+    {
+        std::function<void()> task;
+        if (pop_or_steal(index, &task))
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                queued_--;
+            }
+            task();
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--pending_ == 0)
+            {
+                done_cv_.notify_all();
+            }
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        // a task counted in queued_ may not be in its deque yet, look again
+        work_cv_.wait(lock, [this]() { return queued_ > 0 || stop_; });
+        if (stop_ && queued_ == 0)
+        {
+            return;
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef __WORK_STEALING_POOL_HPP__
+#define __WORK_STEALING_POOL_HPP__
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "noncopyable.hpp"
+
+// Thread pool with a task deque per worker. A worker runs the newest task of its own deque and,
+// when that is empty, steals the oldest task of another one. Tasks submitted from a worker go to
+// its own deque, others are spread round robin.
+class WorkStealingPool
+{
+public:
+    explicit WorkStealingPool(int threads);
+    ~WorkStealingPool();
+
+    void submit(std::function<void()> task);
+    // Blocks until every submitted task has finished.
+    void wait();
+    // tasks run by another worker than the one they were queued on
+    uint64_t steals() const { return steals_.load(std::memory_order_relaxed); }
+
+    NONCOPYABLE(WorkStealingPool);
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    bool pop_or_steal(size_t index, std::function<void()>* task);
+    void worker_loop(size_t index);
+
+private:
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+    std::mutex mutex_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    size_t queued_;   // tasks in the deques, guarded by mutex_
+    size_t pending_;  // queued or running, guarded by mutex_
+    size_t next_;     // round robin for outside submits
+    bool stop_;
+    std::atomic<uint64_t> steals_;
+};
+
+#endif  // __WORK_STEALING_POOL_HPP__
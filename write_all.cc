@@ -0,0 +1,51 @@
+#include "write_all.hpp"
+#include <errno.h>
+#include <unistd.h>
+
+bool write_all(int fd, const void* data, size_t size)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    while (size > 0)
+    {
+        ssize_t n = write(fd, p, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+bool writev_all(int fd, struct iovec* iov, int count)
+{
+    while (count > 0)
+    {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0)
+        {
+            iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
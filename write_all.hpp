@@ -0,0 +1,14 @@
+#ifndef __WRITE_ALL_HPP__
+#define __WRITE_ALL_HPP__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// Writes all of data to fd, retrying partial writes and EINTR. Returns false on any other error.
+bool write_all(int fd, const void* data, size_t size);
+
+// The same for count iovecs, which are advanced over partial writes and so are clobbered.
+bool writev_all(int fd, struct iovec* iov, int count);
+
+#endif  // __WRITE_ALL_HPP__